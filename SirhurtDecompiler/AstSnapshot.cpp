@@ -0,0 +1,414 @@
+#include "AstSnapshot.h"
+#include "parallel_hashmap/phmap.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+using namespace Luau;
+using Snapshot::Kind;
+
+// writes nodes in post-order so every child lands before its parent
+class SnapshotWriter : public Parser::AstVisitor
+{
+	std::string& image;
+
+	std::vector<std::string_view> strings;
+	phmap::flat_hash_map<std::string_view, uint32_t> stringIndices;
+
+	// offset of the node written by the last visit
+	uint32_t last = 0;
+
+	uint32_t offset() const
+	{
+		if (image.size() > UINT32_MAX)
+			throw std::runtime_error("AST is too large for a snapshot");
+
+		return uint32_t(image.size());
+	}
+
+	template <typename T>
+	void append(const T& value)
+	{
+		image.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	uint32_t intern(const char* data, size_t size)
+	{
+		std::string_view str{ data, size };
+
+		auto [it, inserted] = stringIndices.try_emplace(str, uint32_t(strings.size()));
+		if (inserted)
+			strings.push_back(str);
+
+		return it->second;
+	}
+
+	uint32_t intern(const char* str)
+	{
+		return intern(str, strlen(str));
+	}
+
+	uint32_t write(Parser::AstNode* node)
+	{
+		if (!node)
+			return 0;
+
+		node->visit(this);
+		return last;
+	}
+
+	uint32_t writeNode(Kind kind, uint8_t op = 0, uint32_t a = 0, uint32_t b = 0,
+		uint32_t c = 0, uint32_t d = 0, uint32_t e = 0)
+	{
+		Snapshot::Node node{ kind, op, 0, a, b, c, d, e };
+
+		last = offset();
+		append(node);
+		return last;
+	}
+
+	uint32_t writeList(const std::vector<uint32_t>& entries)
+	{
+		uint32_t result = offset();
+
+		append(uint32_t(entries.size()));
+		for (auto entry : entries)
+			append(entry);
+
+		return result;
+	}
+
+	template <typename T>
+	uint32_t writeNodes(const Parser::AstArray<T*>& nodes)
+	{
+		std::vector<uint32_t> entries;
+		entries.reserve(nodes.size);
+
+		for (size_t i = 0; i < nodes.size; ++i)
+			entries.push_back(write(nodes.data[i]));
+
+		return writeList(entries);
+	}
+
+	uint32_t writeNames(const Parser::AstArray<Parser::AstLocal*>& locals)
+	{
+		std::vector<uint32_t> entries;
+		entries.reserve(locals.size);
+
+		for (size_t i = 0; i < locals.size; ++i)
+			entries.push_back(intern(locals.data[i]->name.value));
+
+		return writeList(entries);
+	}
+
+	uint32_t writeFunction(Parser::AstExprFunction* funcExpr)
+	{
+		uint32_t args = writeNames(funcExpr->args);
+		uint32_t body = write(funcExpr->body);
+
+		uint8_t flags = 0;
+		if (funcExpr->vararg)
+			flags |= Snapshot::FunctionVararg;
+		if (funcExpr->self)
+			flags |= Snapshot::FunctionSelf;
+
+		return writeNode(Kind::ExprFunction, flags, args, body);
+	}
+public:
+	SnapshotWriter(std::string& image) : image(image)
+	{
+	}
+
+	uint32_t writeRoot(Parser::AstStat* root)
+	{
+		return write(root);
+	}
+
+	uint32_t writeStrings()
+	{
+		uint32_t result = offset();
+
+		append(uint32_t(strings.size()));
+
+		size_t bytes = size_t(result) + sizeof(uint32_t) + strings.size() * 2 * sizeof(uint32_t);
+		for (const auto& str : strings)
+		{
+			if (bytes + str.size() > UINT32_MAX)
+				throw std::runtime_error("AST is too large for a snapshot");
+
+			append(uint32_t(bytes));
+			append(uint32_t(str.size()));
+			bytes += str.size();
+		}
+
+		for (const auto& str : strings)
+			image.append(str.data(), str.size());
+
+		return result;
+	}
+
+	bool visit(Parser::AstExpr*) override
+	{
+		writeNode(Kind::ExprUnknown);
+		return false;
+	}
+
+	bool visit(Parser::AstStat*) override
+	{
+		writeNode(Kind::StatUnknown);
+		return false;
+	}
+
+	bool visit(Parser::AstExprGroup* groupExpr) override
+	{
+		writeNode(Kind::ExprGroup, 0, write(groupExpr->expr));
+		return false;
+	}
+
+	bool visit(Parser::AstExprConstantNil*) override
+	{
+		writeNode(Kind::ExprNil);
+		return false;
+	}
+
+	bool visit(Parser::AstExprConstantBool* boolExpr) override
+	{
+		writeNode(Kind::ExprBool, boolExpr->value);
+		return false;
+	}
+
+	bool visit(Parser::AstExprConstantNumber* numExpr) override
+	{
+		uint32_t bits[2];
+		memcpy(bits, &numExpr->value, sizeof(bits));
+
+		writeNode(Kind::ExprNumber, 0, bits[0], bits[1]);
+		return false;
+	}
+
+	bool visit(Parser::AstExprConstantString* strExpr) override
+	{
+		writeNode(Kind::ExprString, 0, intern(strExpr->value.data, strExpr->value.size));
+		return false;
+	}
+
+	bool visit(Parser::AstExprLocal* localExpr) override
+	{
+		writeNode(Kind::ExprLocal, 0, intern(localExpr->local->name.value));
+		return false;
+	}
+
+	bool visit(Parser::AstExprGlobal* globalExpr) override
+	{
+		writeNode(Kind::ExprGlobal, 0, intern(globalExpr->name.value));
+		return false;
+	}
+
+	bool visit(Parser::AstExprVarargs*) override
+	{
+		writeNode(Kind::ExprVarargs);
+		return false;
+	}
+
+	bool visit(Parser::AstExprCall* callExpr) override
+	{
+		uint32_t func = write(callExpr->func);
+		uint32_t args = writeNodes(callExpr->args);
+
+		writeNode(Kind::ExprCall, callExpr->self, func, args);
+		return false;
+	}
+
+	bool visit(Parser::AstExprIndexName* indexNameExpr) override
+	{
+		uint32_t expr = write(indexNameExpr->expr);
+
+		writeNode(Kind::ExprIndexName, 0, expr, intern(indexNameExpr->index.value));
+		return false;
+	}
+
+	bool visit(Parser::AstExprIndexExpr* indexExpr) override
+	{
+		uint32_t expr = write(indexExpr->expr);
+		uint32_t index = write(indexExpr->index);
+
+		writeNode(Kind::ExprIndexExpr, 0, expr, index);
+		return false;
+	}
+
+	bool visit(Parser::AstExprFunction* funcExpr) override
+	{
+		writeFunction(funcExpr);
+		return false;
+	}
+
+	bool visit(Parser::AstExprTable* tableExpr) override
+	{
+		writeNode(Kind::ExprTable, 0, writeNodes(tableExpr->pairs));
+		return false;
+	}
+
+	bool visit(Parser::AstExprUnary* unaryExpr) override
+	{
+		writeNode(Kind::ExprUnary, uint8_t(unaryExpr->op), write(unaryExpr->expr));
+		return false;
+	}
+
+	bool visit(Parser::AstExprBinary* binaryExpr) override
+	{
+		uint32_t left = write(binaryExpr->left);
+		uint32_t right = write(binaryExpr->right);
+
+		writeNode(Kind::ExprBinary, uint8_t(binaryExpr->op), left, right);
+		return false;
+	}
+
+	bool visit(Parser::AstStatBlock* blockStat) override
+	{
+		writeNode(Kind::StatBlock, 0, writeNodes(blockStat->body));
+		return false;
+	}
+
+	bool visit(Parser::AstStatIf* ifStat) override
+	{
+		uint32_t condition = write(ifStat->condition);
+		uint32_t thenBody = write(ifStat->thenbody);
+		uint32_t elseBody = write(ifStat->elsebody);
+
+		writeNode(Kind::StatIf, 0, condition, thenBody, elseBody);
+		return false;
+	}
+
+	bool visit(Parser::AstStatWhile* whileStat) override
+	{
+		uint32_t condition = write(whileStat->condition);
+		uint32_t body = write(whileStat->body);
+
+		writeNode(Kind::StatWhile, 0, condition, body);
+		return false;
+	}
+
+	bool visit(Parser::AstStatRepeat* repeatStat) override
+	{
+		uint32_t body = write(repeatStat->body);
+		uint32_t condition = write(repeatStat->condition);
+
+		writeNode(Kind::StatRepeat, 0, body, condition);
+		return false;
+	}
+
+	bool visit(Parser::AstStatBreak*) override
+	{
+		writeNode(Kind::StatBreak);
+		return false;
+	}
+
+	bool visit(Parser::AstStatReturn* retStat) override
+	{
+		writeNode(Kind::StatReturn, 0, writeNodes(retStat->list));
+		return false;
+	}
+
+	bool visit(Parser::AstStatExpr* exprStat) override
+	{
+		writeNode(Kind::StatExpr, 0, write(exprStat->expr));
+		return false;
+	}
+
+	bool visit(Parser::AstStatLocal* localStat) override
+	{
+		uint32_t vars = writeNames(localStat->vars);
+		uint32_t values = writeNodes(localStat->values);
+
+		writeNode(Kind::StatLocal, 0, vars, values);
+		return false;
+	}
+
+	bool visit(Parser::AstStatLocalFunction* localFuncStat) override
+	{
+		uint32_t body = write(localFuncStat->body);
+
+		writeNode(Kind::StatLocalFunction, 0, intern(localFuncStat->var->name.value), body);
+		return false;
+	}
+
+	bool visit(Parser::AstStatFor* forStat) override
+	{
+		uint32_t from = write(forStat->from);
+		uint32_t to = write(forStat->to);
+		uint32_t step = write(forStat->step);
+		uint32_t body = write(forStat->body);
+
+		writeNode(Kind::StatFor, 0, intern(forStat->var->name.value), from, to, step, body);
+		return false;
+	}
+
+	bool visit(Parser::AstStatForIn* forInStat) override
+	{
+		uint32_t vars = writeNames(forInStat->vars);
+		uint32_t values = writeNodes(forInStat->values);
+		uint32_t body = write(forInStat->body);
+
+		writeNode(Kind::StatForIn, 0, vars, values, body);
+		return false;
+	}
+
+	bool visit(Parser::AstStatAssign* assignStat) override
+	{
+		uint32_t vars = writeNodes(assignStat->vars);
+		uint32_t values = writeNodes(assignStat->values);
+
+		writeNode(Kind::StatAssign, 0, vars, values);
+		return false;
+	}
+
+	bool visit(Parser::AstStatFunction* funcStat) override
+	{
+		uint32_t expr = write(funcStat->expr);
+		uint32_t body = write(funcStat->body);
+
+		writeNode(Kind::StatFunction, 0, expr, body);
+		return false;
+	}
+};
+
+std::string Luau::snapshotAst(Parser::AstStat* root, bool flagged)
+{
+	std::string image(sizeof(Snapshot::Header), '\0');
+
+	SnapshotWriter writer{ image };
+	uint32_t rootOffset = writer.writeRoot(root);
+	uint32_t strings = writer.writeStrings();
+
+	if (image.size() > UINT32_MAX)
+		throw std::runtime_error("AST is too large for a snapshot");
+
+	Snapshot::Header header{};
+	header.magic = Snapshot::kMagic;
+	header.version = Snapshot::kVersion;
+	header.size = uint32_t(image.size());
+	header.flags = flagged ? uint32_t(Snapshot::Flagged) : 0u;
+	header.root = rootOffset;
+	header.strings = strings;
+
+	memcpy(&image[0], &header, sizeof(header));
+	return image;
+}
+
+bool Luau::snapshotFlagged(const char* data, size_t size)
+{
+	Snapshot::Header header;
+	if (size < sizeof(header))
+		throw std::runtime_error("malformed AST snapshot: truncated header");
+
+	memcpy(&header, data, sizeof(header));
+
+	if (header.magic != Snapshot::kMagic)
+		throw std::runtime_error("malformed AST snapshot: bad magic");
+	if (header.version != Snapshot::kVersion)
+		throw std::runtime_error("malformed AST snapshot: unsupported version " + std::to_string(header.version));
+
+	return (header.flags & Snapshot::Flagged) != 0;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "OutputBuffer.h"
+#include "Parser.h"
+
+#include <cstdint>
+#include <string>
+
+namespace Luau
+{
+	// Relocatable binary image of an AST that can be written to disk, mapped
+	// back in and formatted without rebuilding the tree. Nodes refer to each
+	// other by byte offset from the start of the image and children are
+	// always stored before their parents. Names and string constants are kept
+	// once in a string section at the end. Integers are little-endian.
+	//
+	// layout: Header, node records and lists, string section
+	//   list:           uint32 count, count node offsets (0 for none)
+	//   string section: uint32 count, count (offset, length) pairs, bytes
+	namespace Snapshot
+	{
+		constexpr uint32_t kMagic = 0x5453414c; // "LAST"
+		constexpr uint32_t kVersion = 1;
+
+		enum Flags : uint32_t
+		{
+			// the decompiler flagged its input as potentially incompatible
+			Flagged = 1 << 0,
+		};
+
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t size;
+			uint32_t flags;
+			uint32_t root;
+			uint32_t strings;
+		};
+
+		enum class Kind : uint8_t
+		{
+			// expressions
+			ExprUnknown,
+			ExprGroup,        // a: expr
+			ExprNil,
+			ExprBool,         // op: value
+			ExprNumber,       // a, b: double bits
+			ExprString,       // a: string
+			ExprLocal,        // a: name string
+			ExprGlobal,       // a: name string
+			ExprVarargs,
+			ExprCall,         // op: self, a: func, b: argument list
+			ExprIndexName,    // a: expr, b: name string
+			ExprIndexExpr,    // a: expr, b: index
+			ExprFunction,     // op: FunctionVararg | FunctionSelf, a: argument name list, b: body block
+			ExprTable,        // a: key/value list, keys may be 0
+			ExprUnary,        // op: AstExprUnary::Op, a: expr
+			ExprBinary,       // op: AstExprBinary::Op, a: left, b: right
+
+			// statements
+			StatUnknown,
+			StatBlock,        // a: statement list
+			StatIf,           // a: condition, b: then block, c: else block or if, or 0
+			StatWhile,        // a: condition, b: body block
+			StatRepeat,       // a: body block, b: condition
+			StatBreak,
+			StatReturn,       // a: expression list
+			StatExpr,         // a: expr
+			StatLocal,        // a: name string list, b: value list
+			StatLocalFunction, // a: name string, b: function
+			StatFor,          // a: name string, b: from, c: to, d: step or 0, e: body block
+			StatForIn,        // a: name string list, b: value list, c: body block
+			StatAssign,       // a: target list, b: value list
+			StatFunction,     // a: target, b: function
+
+			Count
+		};
+
+		enum FunctionFlags : uint8_t
+		{
+			FunctionVararg = 1 << 0,
+			FunctionSelf = 1 << 1,
+		};
+
+		// fixed-size node record; see Kind for what each field holds
+		struct Node
+		{
+			Kind kind;
+			uint8_t op;
+			uint16_t reserved;
+			uint32_t a, b, c, d, e;
+		};
+
+		static_assert(sizeof(Node) == 24, "snapshot node layout changed");
+	}
+
+	// flagged is recorded in the header for the caller to report
+	std::string snapshotAst(Parser::AstStat* root, bool flagged = false);
+
+	// formats a snapshot image exactly as formatAst formats the tree it was
+	// taken from. images are checked as they are read; malformed ones throw
+	void formatSnapshot(OutputBuffer& buff, const char* data, size_t size);
+
+	bool snapshotFlagged(const char* data, size_t size);
+}
@@ -1,826 +1,1733 @@
 #include "CodeFormat.h"
+#include "AstSnapshot.h"
 #include "Parser.h"
 
-#include <sstream>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CODEFORMAT_SSE2 1
+#include <emmintrin.h>
+#endif
 
 using namespace Luau;
 
-class CodeVisitor : public Parser::AstVisitor
+// what a string literal contains, gathered in one pass over its bytes
+struct StringClass
 {
-	std::ostream& buff;
-	uint32_t indent = 0;
-	bool mainEncountered = false;
+	bool hasSingle = false;
+	bool hasDouble = false;
+	bool hasNewline = false;
+	bool hasBackslash = false;
+	bool hasCloseBracket = false;
+	// bytes that can only be written as escapes
+	bool hasControl = false;
+	// usable as a.name and { name = ... }
+	bool identifier = false;
+};
 
-	void writeIndent()
+static bool isIdentifierChar(unsigned char c)
+{
+	return unsigned(c - 'a') < 26 || unsigned(c - 'A') < 26 || unsigned(c - '0') < 10 || c == '_';
+}
+
+static bool isControlChar(unsigned char c)
+{
+	return c < 0x20 || c == 0x7F;
+}
+
+static void classifyChar(StringClass& cls, unsigned char c)
+{
+	switch (c)
 	{
-		std::fill_n(std::ostream_iterator<char>(buff), indent * 4, ' ');
+	case '\'':
+		cls.hasSingle = true;
+		break;
+	case '"':
+		cls.hasDouble = true;
+		break;
+	case '\\':
+		cls.hasBackslash = true;
+		break;
+	case ']':
+		cls.hasCloseBracket = true;
+		break;
+	case '\n':
+		cls.hasNewline = true;
+		break;
+	case '\t':
+		break;
+	default:
+		if (isControlChar(c))
+			cls.hasControl = true;
 	}
+}
 
-	enum class StringQuoteType
-	{
-		Long,
-		Single,
-		Double,
-		Escape
-	};
-	static StringQuoteType getStringQuoteType(const std::string& str)
+static bool isReserved(const char* data, size_t size)
+{
+	for (auto word : Parser::kReserved)
 	{
-		bool hasSingle = false, hasDouble = false;
-		for (size_t i = 0; i < str.size(); ++i)
-		{
-			char c = str[i];
+		if (strlen(word) == size && memcmp(word, data, size) == 0)
+			return true;
+	}
 
-			// TODO: nested long strINNNGSS
-			if (c == '\n' || c == '\\')
-			{
-				return StringQuoteType::Long;
-			}
+	return false;
+}
 
-			if (c == '"')
-			{
-				hasDouble = true;
-			} else if (c == '\'')
-			{
-				hasSingle = true;
-			}
-		}
+#ifdef CODEFORMAT_SSE2
+static unsigned countTrailingZeros(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return unsigned(index);
+#else
+	return unsigned(__builtin_ctz(value));
+#endif
+}
+
+// lanes holding a control character or DEL
+static __m128i controlMask(__m128i chunk)
+{
+	__m128i low = _mm_cmpeq_epi8(_mm_min_epu8(chunk, _mm_set1_epi8(0x1F)), chunk);
+	return _mm_or_si128(low, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(0x7F)));
+}
+
+// lanes holding [A-Za-z0-9_]; bytes >= 0x80 compare as negative and fail
+static __m128i identifierMask(__m128i chunk)
+{
+	__m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+	__m128i underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+	return _mm_or_si128(_mm_or_si128(alpha, digit), underscore);
+}
+#endif
 
-		return hasSingle && !hasDouble || !hasSingle && !hasDouble ? StringQuoteType::Double :
-			hasDouble && !hasSingle ? StringQuoteType::Single : StringQuoteType::Escape;
+static StringClass classifyString(const char* data, size_t size)
+{
+	StringClass cls;
+	bool identifierChars = size > 0 && unsigned(data[0] - '0') >= 10;
+
+	size_t i = 0;
+#ifdef CODEFORMAT_SSE2
+	// most bytes are plain text; only lanes flagged here are looked at
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i special = _mm_or_si128(controlMask(chunk),
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\'')),
+				_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')),
+					_mm_cmpeq_epi8(chunk, _mm_set1_epi8(']')))));
+
+		for (unsigned mask = _mm_movemask_epi8(special); mask; mask &= mask - 1)
+			classifyChar(cls, data[i + countTrailingZeros(mask)]);
+
+		if (_mm_movemask_epi8(identifierMask(chunk)) != 0xFFFF)
+			identifierChars = false;
 	}
+#endif
 
-	static bool isValidName(const std::string& str)
+	for (; i < size; ++i)
 	{
-		for (size_t i = 0; i < str.size(); ++i)
-		{
-			char c = str[i];
-			if (i == 0)
-			{
-				if (isalpha(c) || c == '_')
-				{
-					continue;
-				}
+		classifyChar(cls, data[i]);
 
-				return false;
-			}
+		if (!isIdentifierChar(data[i]))
+			identifierChars = false;
+	}
 
-			if (isalnum(c) || c == '_')
-			{
-				continue;
-			}
+	cls.identifier = identifierChars && !isReserved(data, size);
+	return cls;
+}
 
-			return false;
-		}
+// length of the prefix that can be written between quotes as is
+static size_t scanVerbatim(const char* data, size_t size, char quote)
+{
+	size_t i = 0;
+#ifdef CODEFORMAT_SSE2
+	__m128i quoteChar = _mm_set1_epi8(quote);
+	__m128i backslash = _mm_set1_epi8('\\');
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i escape = _mm_or_si128(controlMask(chunk),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, quoteChar), _mm_cmpeq_epi8(chunk, backslash)));
 
-		return true;
+		if (unsigned mask = _mm_movemask_epi8(escape))
+			return i + countTrailingZeros(mask);
 	}
+#endif
 
-	void visitIf(Parser::AstStatIf* ifStat)
+	for (; i < size; ++i)
 	{
-		ifStat->condition->visit(this);
-		buff << " then\n";
+		unsigned char c = data[i];
+		if (isControlChar(c) || c == quote || c == '\\')
+			return i;
+	}
 
-		indent++;
-		for (const auto& stat : ifStat->thenbody->as<Parser::AstStatBlock>()->body)
-		{
-			stat->visit(this);
-		}
-		indent--;
+	return size;
+}
 
-		if (ifStat->elsebody)
-		{
-			writeIndent();
-			if (auto elseIfStat = ifStat->elsebody->as<Parser::AstStatIf>())
-			{
-				buff << "elseif ";
-				visitIf(elseIfStat);
-				return;
-			}
-			buff << "else\n";
-			indent++;
-			for (const auto& stat : ifStat->elsebody->as<Parser::AstStatBlock>()->body)
-			{
-				stat->visit(this);
-			}
-			indent--;
-		}
-	}
-public:
-	CodeVisitor(std::ostream& buff) : buff(buff)
+// smallest n such that ]=*n] neither occurs in the string nor forms at its end
+static size_t longBracketLevel(const char* data, size_t size)
+{
+	std::vector<bool> used;
+	auto markUsed = [&](size_t level)
 	{
-		buff.precision(14);
-	}
+		if (level >= used.size())
+			used.resize(level + 1);
+		used[level] = true;
+	};
 
-	bool visit(Parser::AstExpr* expr) override
+	for (size_t i = 0; i < size; ++i)
 	{
-		buff << "--[[ unknown ]]";
-		return false;
+		if (data[i] != ']')
+			continue;
+
+		size_t j = i + 1;
+		while (j < size && data[j] == '=')
+			j++;
+
+		if (j == size || data[j] == ']')
+			markUsed(j - i - 1);
 	}
 
-	bool visit(Parser::AstStat* expr) override
+	size_t level = 0;
+	while (level < used.size() && used[level])
+		level++;
+
+	return level;
+}
+
+static void writeRepeated(OutputBuffer& buff, char c, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		buff.put(c);
+}
+
+static void writeEscape(OutputBuffer& buff, unsigned char c, char quote)
+{
+	switch (c)
 	{
-		writeIndent();
-		buff << "-- unknown\n";
-		return false;
+	case '\a': buff << "\\a"; return;
+	case '\b': buff << "\\b"; return;
+	case '\f': buff << "\\f"; return;
+	case '\n': buff << "\\n"; return;
+	case '\r': buff << "\\r"; return;
+	case '\t': buff << "\\t"; return;
+	case '\v': buff << "\\v"; return;
+	case '\\': buff << "\\\\"; return;
 	}
 
-	bool visit(Parser::AstExprGroup* groupExpr) override
+	if (c == quote)
 	{
-		buff << "(";
-		groupExpr->expr->visit(this);
-		buff << ")";
-		return false;
+		buff << '\\' << quote;
+		return;
 	}
 
-	bool visit(Parser::AstExprConstantNil*) override
+	// always three digits so a following digit is not absorbed
+	char digits[4] = { '\\', char('0' + c / 100), char('0' + c / 10 % 10), char('0' + c % 10) };
+	buff.write(digits, 4);
+}
+
+static void writeQuotedString(OutputBuffer& buff, const char* data, size_t size, char quote)
+{
+	buff.put(quote);
+
+	size_t i = 0;
+	while (i < size)
 	{
-		buff << "nil";
-		return false;
+		size_t run = scanVerbatim(data + i, size - i, quote);
+		buff.write(data + i, run);
+		i += run;
+
+		if (i < size)
+			writeEscape(buff, data[i++], quote);
 	}
 
-	bool visit(Parser::AstExprConstantBool* boolExpr) override
+	buff.put(quote);
+}
+
+static void writeLongString(OutputBuffer& buff, const char* data, size_t size, const StringClass& cls)
+{
+	size_t level = cls.hasCloseBracket ? longBracketLevel(data, size) : 0;
+
+	buff.put('[');
+	writeRepeated(buff, '=', level);
+	buff.put('[');
+
+	// the first newline after the opening bracket is skipped when read
+	if (size > 0 && data[0] == '\n')
+		buff.put('\n');
+
+	buff.write(data, size);
+
+	buff.put(']');
+	writeRepeated(buff, '=', level);
+	buff.put(']');
+}
+
+static void writeString(OutputBuffer& buff, const char* data, size_t size, const StringClass& cls)
+{
+	// long brackets keep multi-line and backslash-heavy strings readable,
+	// but cannot carry control characters
+	if (!cls.hasControl && (cls.hasNewline || cls.hasBackslash))
+		writeLongString(buff, data, size, cls);
+	else if (!cls.hasDouble)
+		writeQuotedString(buff, data, size, '"');
+	else if (!cls.hasSingle)
+		writeQuotedString(buff, data, size, '\'');
+	else
+		writeQuotedString(buff, data, size, '"');
+}
+
+// spelling of a binary operator with its surrounding spaces
+static const char* binaryOperator(int op)
+{
+	switch (op)
 	{
-		buff << (boolExpr->value ? "true" : "false");
-		return false;
+	case Parser::AstExprBinary::Add:
+		return " + ";
+	case Parser::AstExprBinary::Sub:
+		return " - ";
+	case Parser::AstExprBinary::Mul:
+		return " * ";
+	case Parser::AstExprBinary::Div:
+		return " / ";
+	case Parser::AstExprBinary::Mod:
+		return " % ";
+	case Parser::AstExprBinary::Pow:
+		return " ^ ";
+	case Parser::AstExprBinary::Concat:
+		return " .. ";
+	case Parser::AstExprBinary::CompareNe:
+		return " ~= ";
+	case Parser::AstExprBinary::CompareEq:
+		return " == ";
+	case Parser::AstExprBinary::CompareLt:
+		return " < ";
+	case Parser::AstExprBinary::CompareLe:
+		return " <= ";
+	case Parser::AstExprBinary::CompareGt:
+		return " > ";
+	case Parser::AstExprBinary::CompareGe:
+		return " >= ";
+	case Parser::AstExprBinary::And:
+		return " and ";
+	case Parser::AstExprBinary::Or:
+		return " or ";
+	default:
+		return "";
 	}
+}
 
-	bool visit(Parser::AstExprConstantNumber* numExpr) override
+class ParallelFormat;
+struct FormatJob;
+
+// Writes source code for a tree of nodes. Source supplies the nodes, so the
+// parsed tree and a snapshot image of it are formatted by the same code.
+// A Source has a Node handle that tests false when absent, kind(node), an
+// accessor for each field listed in Snapshot::Kind, count/item/optionalItem
+// for expression and statement lists, count/nameAt for name lists, and
+// split(body, indent, buff), which returns true when it formats a function
+// body elsewhere
+template <typename Source>
+class CodeEmitter
+{
+	using Kind = Snapshot::Kind;
+	using Node = typename Source::Node;
+
+	const Source& source;
+	OutputBuffer& buff;
+	uint32_t indent = 0;
+	bool mainEncountered = false;
+
+	void writeIndent()
 	{
-		buff << numExpr->value;
-		return false;
+		buff.writeIndent(indent);
 	}
 
-	bool visit(Parser::AstExprConstantString* strExpr) override
+	template <typename List>
+	void writeNames(const List& names)
 	{
-		auto str = std::string{ strExpr->value.data, strExpr->value.size };
-		switch (getStringQuoteType(str))
+		size_t count = source.count(names);
+		for (size_t i = 0; i < count; ++i)
 		{
-		case StringQuoteType::Single:
-			buff << '\'' << str << '\'';
-			break;
-		case StringQuoteType::Double:
-			buff << '"' << str << '"';
-			break;
-		case StringQuoteType::Escape:
-		case StringQuoteType::Long:
-			buff << "[[" << str << "]]";
-			break;
-		}
+			buff << source.nameAt(names, i);
 
-		return false;
+			if (i != count - 1)
+			{
+				buff << ", ";
+			}
+		}
 	}
 
-	bool visit(Parser::AstExprLocal* localExpr) override
+	template <typename List>
+	void writeList(const List& exprs)
 	{
-		buff << localExpr->local->name.value;
-		return false;
-	}
+		size_t count = source.count(exprs);
+		for (size_t i = 0; i < count; ++i)
+		{
+			format(source.item(exprs, i));
 
-	bool visit(Parser::AstExprGlobal* globalExpr) override
-	{
-		buff << globalExpr->name.value;
-		return false;
+			if (i != count - 1)
+			{
+				buff << ", ";
+			}
+		}
 	}
 
-	bool visit(Parser::AstExprVarargs*) override
+	// statements of a block nested in a function, loop or if
+	void writeBody(const Node& block)
 	{
-		buff << "...";
-		return false;
+		auto body = source.statements(block);
+		size_t count = source.count(body);
+
+		indent++;
+		for (size_t i = 0; i < count; ++i)
+		{
+			format(source.item(body, i));
+		}
+		indent--;
 	}
 
-	bool visit(Parser::AstExprCall* callExpr) override
+	// parameter list and body of a function, from "(" to "end"
+	void writeFunction(const Node& func)
 	{
-		if (callExpr->self && callExpr->func->is<Parser::AstExprIndexName>())
-		{
-			auto indexNameExpr = callExpr->func->as<Parser::AstExprIndexName>();
+		auto args = source.functionArgs(func);
+		writeNames(args);
 
-			indexNameExpr->expr->visit(this);
-			buff << ":" << indexNameExpr->index.value;
-		}
-		else
+		if (source.functionVararg(func))
 		{
-			bool noParen =
-				callExpr->func->is<Parser::AstExprLocal>()
-				|| callExpr->func->is<Parser::AstExprGlobal>()
-				|| callExpr->func->is<Parser::AstExprGroup>()
-				|| callExpr->func->is<Parser::AstExprIndexName>()
-				|| callExpr->func->is<Parser::AstExprIndexExpr>();
-			if (!noParen)
-			{
-				buff << "(";
-			}
-			callExpr->func->visit(this);
-			if (!noParen)
+			if (source.count(args) > 0)
 			{
-				buff << ")";
+				buff << ", ";
 			}
+			buff << "...";
 		}
-		
-		buff << "(";
-		for (size_t i = 0; i < callExpr->args.size; ++i)
-		{
-			auto expr = callExpr->args.data[i];
-			expr->visit(this);
+		buff << ")\n";
 
-			if (i != callExpr->args.size - 1)
-			{
-				buff << ", ";
-			}
+		auto body = source.functionBody(func);
+		if (!source.split(body, indent, buff))
+		{
+			writeBody(body);
 		}
-		buff << ")";
 
-		return false;
+		writeIndent();
+		buff << "end";
 	}
 
-	bool visit(Parser::AstExprIndexName* indexNameExpr) override
+	void writeIf(const Node& ifStat)
 	{
-		indexNameExpr->expr->visit(this);
-		buff << "." << indexNameExpr->index.value;
+		format(source.ifCondition(ifStat));
+		buff << " then\n";
 
-		return false;
-	}
+		writeBody(source.ifThen(ifStat));
 
-	bool visit(Parser::AstExprIndexExpr* indexExpr) override
-	{
-		indexExpr->expr->visit(this);
-		if (auto strExpr = indexExpr->index->as<Parser::AstExprConstantString>())
+		if (auto elseBody = source.ifElse(ifStat))
 		{
-			std::string str{ strExpr->value.data, strExpr->value.size };
-			if (isValidName(str))
+			writeIndent();
+			if (source.kind(elseBody) == Kind::StatIf)
 			{
-				buff << "." << str;
-				return false;
+				buff << "elseif ";
+				writeIf(elseBody);
+				return;
 			}
+			buff << "else\n";
+			writeBody(elseBody);
 		}
-		buff << "[";
-		indexExpr->index->visit(this);
-		buff << "]";
+	}
 
-		return false;
+	// a string constant used as a key: name when it is an identifier,
+	// quoted in brackets otherwise
+	bool writeKey(const Node& key, const char* dot, const char* assign)
+	{
+		if (source.kind(key) != Kind::ExprString)
+			return false;
+
+		std::string_view value = source.stringValue(key);
+		auto cls = classifyString(value.data(), value.size());
+		if (cls.identifier)
+		{
+			buff << dot;
+			buff.write(value.data(), value.size());
+			buff << assign;
+		}
+		else
+		{
+			buff << "[";
+			writeString(buff, value.data(), value.size(), cls);
+			buff << "]" << assign;
+		}
+		return true;
+	}
+public:
+	// mainEncountered: the main block has already been entered, as is the
+	// case for statements formatted on their own
+	CodeEmitter(const Source& source, OutputBuffer& buff, bool mainEncountered = false, uint32_t indent = 0)
+		: source(source), buff(buff), indent(indent), mainEncountered(mainEncountered)
+	{
 	}
 
-	bool visit(Parser::AstExprFunction* funcExpr) override
+	void format(const Node& n)
 	{
-		buff << "function(";
-		for (size_t i = 0; i < funcExpr->args.size; ++i)
+		switch (source.kind(n))
 		{
-			auto expr = funcExpr->args.data[i];
-			buff << expr->name.value;
+		case Kind::ExprUnknown:
+			buff << "--[[ unknown ]]";
+			break;
 
-			if (i != funcExpr->args.size - 1)
-			{
-				buff << ", ";
-			}
+		case Kind::ExprGroup:
+			buff << "(";
+			format(source.groupExpr(n));
+			buff << ")";
+			break;
+
+		case Kind::ExprNil:
+			buff << "nil";
+			break;
+
+		case Kind::ExprBool:
+			buff << (source.boolValue(n) ? "true" : "false");
+			break;
+
+		case Kind::ExprNumber:
+			buff.writeNumber(source.numberValue(n));
+			break;
+
+		case Kind::ExprString:
+		{
+			auto value = source.stringValue(n);
+			writeString(buff, value.data(), value.size(), classifyString(value.data(), value.size()));
+			break;
 		}
 
-		if (funcExpr->vararg)
+		case Kind::ExprLocal:
+			buff << source.localName(n);
+			break;
+
+		case Kind::ExprGlobal:
+			buff << source.globalName(n);
+			break;
+
+		case Kind::ExprVarargs:
+			buff << "...";
+			break;
+
+		case Kind::ExprCall:
 		{
-			if (funcExpr->args.size > 0)
+			auto func = source.callFunc(n);
+			auto funcKind = source.kind(func);
+			if (source.callSelf(n) && funcKind == Kind::ExprIndexName)
 			{
-				buff << ", ";
+				format(source.indexNameExpr(func));
+				buff << ":" << source.indexName(func);
 			}
-			buff << "...";
+			else
+			{
+				bool noParen =
+					funcKind == Kind::ExprLocal
+					|| funcKind == Kind::ExprGlobal
+					|| funcKind == Kind::ExprGroup
+					|| funcKind == Kind::ExprIndexName
+					|| funcKind == Kind::ExprIndexExpr;
+				if (!noParen)
+				{
+					buff << "(";
+				}
+				format(func);
+				if (!noParen)
+				{
+					buff << ")";
+				}
+			}
+
+			buff << "(";
+			writeList(source.callArgs(n));
+			buff << ")";
+			break;
 		}
-		buff << ")\n";
 
-		indent++;
-		for (const auto& stat : funcExpr->body->as<Parser::AstStatBlock>()->body)
+		case Kind::ExprIndexName:
+			format(source.indexNameExpr(n));
+			buff << "." << source.indexName(n);
+			break;
+
+		case Kind::ExprIndexExpr:
 		{
-			stat->visit(this);
-		}
-		indent--;
+			format(source.indexExpr(n));
 
-		writeIndent();
-		buff << "end";
+			auto index = source.indexKey(n);
+			if (writeKey(index, ".", ""))
+				break;
 
-		return false;
-	}
+			buff << "[";
+			format(index);
+			buff << "]";
+			break;
+		}
 
-	bool visit(Parser::AstExprTable* tableExpr) override
-	{
-		buff << "{";
+		case Kind::ExprFunction:
+			buff << "function(";
+			writeFunction(n);
+			break;
 
-		if (tableExpr->pairs.size > 0)
+		case Kind::ExprTable:
 		{
-			indent++;
+			auto pairs = source.tablePairs(n);
+			size_t count = source.count(pairs);
 
-			for (size_t i = 0; i < tableExpr->pairs.size; i += 2)
+			buff << "{";
+
+			if (count > 0)
 			{
-				if (i % 30 * 2 == 0)
+				indent++;
+
+				for (size_t i = 0; i < count; i += 2)
 				{
-					buff << "\n";
-					writeIndent();
-				}
+					if (i % 30 * 2 == 0)
+					{
+						buff << "\n";
+						writeIndent();
+					}
 
-				auto k = tableExpr->pairs.data[i];
-				auto v = tableExpr->pairs.data[i + 1];
+					auto k = source.optionalItem(pairs, i);
+					auto v = source.item(pairs, i + 1);
 
-				if (k) // put on new line?
-				{
-					if (auto strExpr = k->as<Parser::AstExprConstantString>())
+					if (k && !writeKey(k, "", " = "))
 					{
-						auto strVal = std::string{ strExpr->value.data, strExpr->value.size };
-						if (isValidName(strVal))
-						{
-							buff << strVal << " = ";
-							goto end;
-						}
+						buff << "[";
+						format(k);
+						buff << "] = ";
 					}
-					buff << "[";
-					k->visit(this);
-					buff << "] = ";
-				}
-			end:
-				v->visit(this);
+					format(v);
 
-				if (i != tableExpr->pairs.size - 2)
-				{
-					buff << ", ";
-				}
-				else
-				{
-					buff << "\n";
+					if (i != count - 2)
+					{
+						buff << ", ";
+					}
+					else
+					{
+						buff << "\n";
+					}
 				}
-			}
 
-			indent--;
+				indent--;
 
-			writeIndent();
-		}
+				writeIndent();
+			}
 
-		buff << "}";
+			buff << "}";
+			break;
+		}
 
-		return false;
-	}
+		case Kind::ExprUnary:
+			switch (source.unaryOp(n))
+			{
+			case Parser::AstExprUnary::Not:
+				buff << "not ";
+				break;
+			case Parser::AstExprUnary::Minus: // TODO: rename to negate?
+				buff << "-";
+				break;
+			case Parser::AstExprUnary::Len:
+				buff << "#";
+				break;
+			default: ;
+			}
 
-	bool visit(Parser::AstExprUnary* unaryExpr) override
-	{
-		switch (unaryExpr->op)
-		{
-		case Parser::AstExprUnary::Not:
-			buff << "not ";
+			format(source.unaryExpr(n));
 			break;
-		case Parser::AstExprUnary::Minus: // TODO: rename to negate?
-			buff << "-";
+
+		case Kind::ExprBinary:
+			format(source.binaryLeft(n));
+			buff << binaryOperator(source.binaryOp(n));
+			format(source.binaryRight(n));
 			break;
-		case Parser::AstExprUnary::Len:
-			buff << "#";
+
+		case Kind::StatUnknown:
+			writeIndent();
+			buff << "-- unknown\n";
 			break;
-		default: ;
-		}
 
-		unaryExpr->expr->visit(this);
+		case Kind::StatBlock:
+		{
+			bool wasMainEncountered = mainEncountered;
 
-		return false;
-	}
+			mainEncountered = true;
 
-	bool visit(Parser::AstExprBinary* binaryExpr) override
-	{
-		binaryExpr->left->visit(this);
+			if (wasMainEncountered)
+			{
+				writeIndent();
+				buff << "do";
+			}
 
-		switch (binaryExpr->op)
-		{
-		case Parser::AstExprBinary::Add:
-			buff << " + ";
-			break;
-		case Parser::AstExprBinary::Sub:
-			buff << " - ";
+			auto body = source.statements(n);
+			size_t count = source.count(body);
+			if (count)
+			{
+				if (wasMainEncountered)
+				{
+					buff << '\n';
+					indent++;
+				}
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					format(source.item(body, i));
+				}
+
+				if (wasMainEncountered)
+				{
+					indent--;
+					writeIndent();
+				}
+			}
+			else
+			{
+				buff << ' ';
+			}
+
+			if (wasMainEncountered)
+			{
+				buff << "end\n";
+			}
 			break;
-		case Parser::AstExprBinary::Mul:
-			buff << " * "; 
+		}
+
+		case Kind::StatIf:
+			writeIndent();
+			buff << "if ";
+			writeIf(n);
+			writeIndent();
+			buff << "end\n";
 			break;
-		case Parser::AstExprBinary::Div:
-			buff << " / ";
+
+		case Kind::StatWhile:
+			writeIndent();
+			buff << "while ";
+			format(source.whileCondition(n));
+			buff << " do\n";
+			writeBody(source.whileBody(n));
+			writeIndent();
+			buff << "end\n";
 			break;
-		case Parser::AstExprBinary::Mod:
-			buff << " % ";
+
+		case Kind::StatRepeat:
+			writeIndent();
+			buff << "repeat\n";
+			writeBody(source.repeatBody(n));
+			writeIndent();
+			buff << "until ";
+			format(source.repeatCondition(n));
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::Pow:
-			buff << " ^ ";
+
+		case Kind::StatBreak:
+			writeIndent();
+			buff << "break\n";
 			break;
-		case Parser::AstExprBinary::Concat:
-			buff << " .. ";
+
+		case Kind::StatReturn:
+			writeIndent();
+			buff << "return ";
+			writeList(source.returnList(n));
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::CompareNe:
-			buff << " ~= ";
+
+		case Kind::StatExpr:
+			writeIndent();
+			format(source.statExpr(n));
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::CompareEq:
-			buff << " == ";
+
+		case Kind::StatLocal:
+		{
+			writeIndent();
+			buff << "local ";
+			writeNames(source.localVars(n));
+
+			auto values = source.localValues(n);
+			size_t count = source.count(values);
+			if (count > 0)
+			{
+				if (count == 1 && source.kind(source.item(values, 0)) == Kind::ExprNil)
+				{
+					buff << "\n";
+					break;
+				}
+				buff << " = ";
+				writeList(values);
+			}
+
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::CompareLt:
-			buff << " < ";
+		}
+
+		case Kind::StatLocalFunction:
+			writeIndent();
+			buff << "local function " << source.localFunctionName(n) << "(";
+			writeFunction(source.localFunction(n));
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::CompareLe:
-			buff << " <= ";
+
+		case Kind::StatFor:
+		{
+			writeIndent();
+			buff << "for " << source.forVar(n) << " = ";
+			format(source.forFrom(n));
+			buff << ", ";
+			format(source.forTo(n));
+
+			if (auto step = source.forStep(n))
+			{
+				buff << ", ";
+				format(step);
+			}
+
+			buff << " do\n";
+			writeBody(source.forBody(n));
+			writeIndent();
+			buff << "end\n";
 			break;
-		case Parser::AstExprBinary::CompareGt:
-			buff << " > ";
+		}
+
+		case Kind::StatForIn:
+			writeIndent();
+			buff << "for ";
+			writeNames(source.forInVars(n));
+			buff << " in ";
+			writeList(source.forInValues(n));
+			buff << " do\n";
+			writeBody(source.forInBody(n));
+			writeIndent();
+			buff << "end\n";
 			break;
-		case Parser::AstExprBinary::CompareGe:
-			buff << " >= ";
+
+		case Kind::StatAssign:
+			writeIndent();
+			writeList(source.assignVars(n));
+			buff << " = ";
+			writeList(source.assignValues(n));
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::And:
-			buff << " and ";
+
+		case Kind::StatFunction:
+		{
+			writeIndent();
+			auto func = source.functionValue(n);
+
+			buff << "function ";
+			auto target = source.functionTarget(n);
+			if (source.functionSelf(func) && source.kind(target) == Kind::ExprIndexName)
+			{
+				format(source.indexNameExpr(target));
+				buff << ":" << source.indexName(target);
+			}
+			else
+			{
+				format(target);
+			}
+
+			buff << "(";
+			writeFunction(func);
+			buff << "\n";
 			break;
-		case Parser::AstExprBinary::Or:
-			buff << " or ";
+		}
+
+		default:
+			// sources only hand out kinds below Count
 			break;
-		default: ;
 		}
+	}
+};
 
-		binaryExpr->right->visit(this);
+// the parsed tree as a CodeEmitter source. In parallel mode large function
+// bodies are handed to other threads, and job records where their text goes
+class TreeSource
+{
+	// the node kind of a tree node, in snapshot terms
+	class KindOf : public Parser::AstVisitor
+	{
+	public:
+		Snapshot::Kind kind = Snapshot::Kind::ExprUnknown;
+
+		bool visit(Parser::AstExpr*) override { kind = Snapshot::Kind::ExprUnknown; return false; }
+		bool visit(Parser::AstStat*) override { kind = Snapshot::Kind::StatUnknown; return false; }
+		bool visit(Parser::AstExprGroup*) override { kind = Snapshot::Kind::ExprGroup; return false; }
+		bool visit(Parser::AstExprConstantNil*) override { kind = Snapshot::Kind::ExprNil; return false; }
+		bool visit(Parser::AstExprConstantBool*) override { kind = Snapshot::Kind::ExprBool; return false; }
+		bool visit(Parser::AstExprConstantNumber*) override { kind = Snapshot::Kind::ExprNumber; return false; }
+		bool visit(Parser::AstExprConstantString*) override { kind = Snapshot::Kind::ExprString; return false; }
+		bool visit(Parser::AstExprLocal*) override { kind = Snapshot::Kind::ExprLocal; return false; }
+		bool visit(Parser::AstExprGlobal*) override { kind = Snapshot::Kind::ExprGlobal; return false; }
+		bool visit(Parser::AstExprVarargs*) override { kind = Snapshot::Kind::ExprVarargs; return false; }
+		bool visit(Parser::AstExprCall*) override { kind = Snapshot::Kind::ExprCall; return false; }
+		bool visit(Parser::AstExprIndexName*) override { kind = Snapshot::Kind::ExprIndexName; return false; }
+		bool visit(Parser::AstExprIndexExpr*) override { kind = Snapshot::Kind::ExprIndexExpr; return false; }
+		bool visit(Parser::AstExprFunction*) override { kind = Snapshot::Kind::ExprFunction; return false; }
+		bool visit(Parser::AstExprTable*) override { kind = Snapshot::Kind::ExprTable; return false; }
+		bool visit(Parser::AstExprUnary*) override { kind = Snapshot::Kind::ExprUnary; return false; }
+		bool visit(Parser::AstExprBinary*) override { kind = Snapshot::Kind::ExprBinary; return false; }
+		bool visit(Parser::AstStatBlock*) override { kind = Snapshot::Kind::StatBlock; return false; }
+		bool visit(Parser::AstStatIf*) override { kind = Snapshot::Kind::StatIf; return false; }
+		bool visit(Parser::AstStatWhile*) override { kind = Snapshot::Kind::StatWhile; return false; }
+		bool visit(Parser::AstStatRepeat*) override { kind = Snapshot::Kind::StatRepeat; return false; }
+		bool visit(Parser::AstStatBreak*) override { kind = Snapshot::Kind::StatBreak; return false; }
+		bool visit(Parser::AstStatReturn*) override { kind = Snapshot::Kind::StatReturn; return false; }
+		bool visit(Parser::AstStatExpr*) override { kind = Snapshot::Kind::StatExpr; return false; }
+		bool visit(Parser::AstStatLocal*) override { kind = Snapshot::Kind::StatLocal; return false; }
+		bool visit(Parser::AstStatLocalFunction*) override { kind = Snapshot::Kind::StatLocalFunction; return false; }
+		bool visit(Parser::AstStatFor*) override { kind = Snapshot::Kind::StatFor; return false; }
+		bool visit(Parser::AstStatForIn*) override { kind = Snapshot::Kind::StatForIn; return false; }
+		bool visit(Parser::AstStatAssign*) override { kind = Snapshot::Kind::StatAssign; return false; }
+		bool visit(Parser::AstStatFunction*) override { kind = Snapshot::Kind::StatFunction; return false; }
+	};
 
-		return false;
+	template <typename T>
+	static T* get(Parser::AstNode* n)
+	{
+		return static_cast<T*>(n);
 	}
 
-	bool visit(Parser::AstStatBlock* blockStat) override
+	ParallelFormat* parallel = nullptr;
+	FormatJob* job = nullptr;
+public:
+	using Node = Parser::AstNode*;
+	using Exprs = Parser::AstArray<Parser::AstExpr*>;
+	using Stats = Parser::AstArray<Parser::AstStat*>;
+	using Names = Parser::AstArray<Parser::AstLocal*>;
+
+	TreeSource() = default;
+
+	TreeSource(ParallelFormat* parallel, FormatJob* job)
+		: parallel(parallel), job(job)
 	{
-		bool wasMainEncountered = mainEncountered;
+	}
 
-		mainEncountered = true;
+	Snapshot::Kind kind(Node n) const
+	{
+		KindOf visitor;
+		n->visit(&visitor);
+		return visitor.kind;
+	}
 
-		if (wasMainEncountered)
-		{
-			writeIndent();
-			buff << "do";
-		}
+	template <typename T>
+	size_t count(const Parser::AstArray<T>& list) const
+	{
+		return list.size;
+	}
+
+	template <typename T>
+	Node item(const Parser::AstArray<T*>& list, size_t i) const
+	{
+		return list.data[i];
+	}
 
-		if (blockStat->body.size)
+	Node optionalItem(const Exprs& list, size_t i) const
+	{
+		return list.data[i];
+	}
+
+	const char* nameAt(const Names& list, size_t i) const
+	{
+		return list.data[i]->name.value;
+	}
+
+	bool split(Node body, uint32_t indent, OutputBuffer& buff) const;
+
+	Node groupExpr(Node n) const { return get<Parser::AstExprGroup>(n)->expr; }
+	bool boolValue(Node n) const { return get<Parser::AstExprConstantBool>(n)->value; }
+	double numberValue(Node n) const { return get<Parser::AstExprConstantNumber>(n)->value; }
+
+	std::string_view stringValue(Node n) const
+	{
+		const auto& value = get<Parser::AstExprConstantString>(n)->value;
+		return { value.data, value.size };
+	}
+
+	const char* localName(Node n) const { return get<Parser::AstExprLocal>(n)->local->name.value; }
+	const char* globalName(Node n) const { return get<Parser::AstExprGlobal>(n)->name.value; }
+	Node callFunc(Node n) const { return get<Parser::AstExprCall>(n)->func; }
+	const Exprs& callArgs(Node n) const { return get<Parser::AstExprCall>(n)->args; }
+	bool callSelf(Node n) const { return get<Parser::AstExprCall>(n)->self; }
+	Node indexNameExpr(Node n) const { return get<Parser::AstExprIndexName>(n)->expr; }
+	const char* indexName(Node n) const { return get<Parser::AstExprIndexName>(n)->index.value; }
+	Node indexExpr(Node n) const { return get<Parser::AstExprIndexExpr>(n)->expr; }
+	Node indexKey(Node n) const { return get<Parser::AstExprIndexExpr>(n)->index; }
+	const Names& functionArgs(Node n) const { return get<Parser::AstExprFunction>(n)->args; }
+	bool functionVararg(Node n) const { return get<Parser::AstExprFunction>(n)->vararg; }
+	bool functionSelf(Node n) const { return get<Parser::AstExprFunction>(n)->self; }
+	Node functionBody(Node n) const { return get<Parser::AstExprFunction>(n)->body; }
+	const Exprs& tablePairs(Node n) const { return get<Parser::AstExprTable>(n)->pairs; }
+	int unaryOp(Node n) const { return get<Parser::AstExprUnary>(n)->op; }
+	Node unaryExpr(Node n) const { return get<Parser::AstExprUnary>(n)->expr; }
+	int binaryOp(Node n) const { return get<Parser::AstExprBinary>(n)->op; }
+	Node binaryLeft(Node n) const { return get<Parser::AstExprBinary>(n)->left; }
+	Node binaryRight(Node n) const { return get<Parser::AstExprBinary>(n)->right; }
+
+	const Stats& statements(Node n) const { return n->as<Parser::AstStatBlock>()->body; }
+	Node ifCondition(Node n) const { return get<Parser::AstStatIf>(n)->condition; }
+	Node ifThen(Node n) const { return get<Parser::AstStatIf>(n)->thenbody; }
+	Node ifElse(Node n) const { return get<Parser::AstStatIf>(n)->elsebody; }
+	Node whileCondition(Node n) const { return get<Parser::AstStatWhile>(n)->condition; }
+	Node whileBody(Node n) const { return get<Parser::AstStatWhile>(n)->body; }
+	Node repeatBody(Node n) const { return get<Parser::AstStatRepeat>(n)->body; }
+	Node repeatCondition(Node n) const { return get<Parser::AstStatRepeat>(n)->condition; }
+	const Exprs& returnList(Node n) const { return get<Parser::AstStatReturn>(n)->list; }
+	Node statExpr(Node n) const { return get<Parser::AstStatExpr>(n)->expr; }
+	const Names& localVars(Node n) const { return get<Parser::AstStatLocal>(n)->vars; }
+	const Exprs& localValues(Node n) const { return get<Parser::AstStatLocal>(n)->values; }
+	const char* localFunctionName(Node n) const { return get<Parser::AstStatLocalFunction>(n)->var->name.value; }
+	Node localFunction(Node n) const { return get<Parser::AstStatLocalFunction>(n)->body; }
+	const char* forVar(Node n) const { return get<Parser::AstStatFor>(n)->var->name.value; }
+	Node forFrom(Node n) const { return get<Parser::AstStatFor>(n)->from; }
+	Node forTo(Node n) const { return get<Parser::AstStatFor>(n)->to; }
+	Node forStep(Node n) const { return get<Parser::AstStatFor>(n)->step; }
+	Node forBody(Node n) const { return get<Parser::AstStatFor>(n)->body; }
+	const Names& forInVars(Node n) const { return get<Parser::AstStatForIn>(n)->vars; }
+	const Exprs& forInValues(Node n) const { return get<Parser::AstStatForIn>(n)->values; }
+	Node forInBody(Node n) const { return get<Parser::AstStatForIn>(n)->body; }
+	const Exprs& assignVars(Node n) const { return get<Parser::AstStatAssign>(n)->vars; }
+	const Exprs& assignValues(Node n) const { return get<Parser::AstStatAssign>(n)->values; }
+	Node functionTarget(Node n) const { return get<Parser::AstStatFunction>(n)->expr; }
+	Node functionValue(Node n) const { return get<Parser::AstStatFunction>(n)->body; }
+};
+
+// a piece of output formatted on its own; the text of children[i] goes
+// between parts[i] and parts[i + 1]
+struct FormatJob
+{
+	Parser::AstStat* root;
+	// root is a function body at this indent, or the main block when 0
+	Parser::AstStatBlock* body;
+	uint32_t indent;
+
+	std::vector<std::string> parts;
+	std::vector<FormatJob*> children;
+
+	FormatJob(Parser::AstStat* root, Parser::AstStatBlock* body, uint32_t indent)
+		: root(root), body(body), indent(indent)
+	{
+	}
+};
+
+// Formats function bodies on a pool of threads. Each job writes its own
+// buffers and leaves a child job wherever a large nested body was split
+// off, so the pieces concatenated in order are exactly what CodeEmitter
+// writes serially.
+class ParallelFormat
+{
+	// bodies with fewer statements are cheaper to format in place than to
+	// hand to another thread
+	static constexpr size_t kMinBodySize = 64;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	std::deque<FormatJob> jobs;
+	std::deque<FormatJob*> queue;
+	size_t pending = 0;
+	std::exception_ptr error;
+
+	// workers are started as bodies are split off, so small trees never
+	// pay for threads
+	std::vector<std::thread> workers;
+	unsigned maxWorkers = 0;
+
+	void format(FormatJob& job)
+	{
+		OutputBuffer buff;
+		TreeSource source{ this, &job };
+
+		if (job.body)
 		{
-			if (wasMainEncountered)
+			CodeEmitter<TreeSource> emitter{ source, buff, true, job.indent };
+			for (const auto& stat : job.body->body)
 			{
-				buff << '\n';
-				indent++;
+				emitter.format(stat);
 			}
+		}
+		else
+		{
+			CodeEmitter<TreeSource> emitter{ source, buff };
+			emitter.format(job.root);
+		}
+
+		job.parts.push_back(buff.take());
+	}
 
-			for (const auto& stat : blockStat->body)
+	void work()
+	{
+		std::unique_lock<std::mutex> lock{ mutex };
+		for (;;)
+		{
+			wake.wait(lock, [this] { return !queue.empty() || pending == 0; });
+			if (queue.empty())
+				return;
+
+			FormatJob* job = queue.front();
+			queue.pop_front();
+
+			lock.unlock();
+			try
 			{
-				stat->visit(this);
+				format(*job);
 			}
-
-			if (wasMainEncountered)
+			catch (...)
 			{
-				indent--;
-				writeIndent();
+				lock.lock();
+				if (!error)
+					error = std::current_exception();
+				lock.unlock();
 			}
+			lock.lock();
+
+			if (--pending == 0)
+				wake.notify_all();
 		}
-		else
+	}
+
+	void assemble(OutputBuffer& buff, const FormatJob& job)
+	{
+		for (size_t i = 0; i < job.parts.size(); ++i)
 		{
-			buff << ' ';
+			buff << job.parts[i];
+
+			if (i < job.children.size())
+				assemble(buff, *job.children[i]);
 		}
+	}
+
+	FormatJob* push(Parser::AstStat* root, Parser::AstStatBlock* body, uint32_t indent)
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+
+		jobs.emplace_back(root, body, indent);
+		queue.push_back(&jobs.back());
+		pending++;
+
+		if (body && workers.size() < maxWorkers)
+			workers.emplace_back([this] { work(); });
+		else
+			wake.notify_one();
+
+		return &jobs.back();
+	}
+public:
+	static bool worthSplitting(const Parser::AstStatBlock* body)
+	{
+		return body->body.size >= kMinBodySize;
+	}
+
+	// queues body to be formatted at indent; called from any thread
+	FormatJob* spawn(Parser::AstStatBlock* body, uint32_t indent)
+	{
+		return push(nullptr, body, indent);
+	}
+
+	void run(OutputBuffer& buff, Parser::AstStat* root, unsigned threads)
+	{
+		maxWorkers = threads - 1;
+
+		FormatJob* main = push(root, nullptr, 0);
+
+		work();
+
+		// nothing is pending, so no more workers can be started
+		for (auto& worker : workers)
+			worker.join();
+
+		if (error)
+			std::rethrow_exception(error);
+
+		assemble(buff, *main);
+	}
+};
+
+bool TreeSource::split(Node body, uint32_t indent, OutputBuffer& buff) const
+{
+	auto block = body->as<Parser::AstStatBlock>();
+	if (!parallel || !ParallelFormat::worthSplitting(block))
+		return false;
+
+	job->parts.push_back(buff.take());
+	job->children.push_back(parallel->spawn(block, indent + 1));
+	return true;
+}
+
+// a snapshot image as a CodeEmitter source, read in place. Every node,
+// list and string is checked as it is read, and malformed images throw
+class SnapshotSource
+{
+	using Kind = Snapshot::Kind;
+
+	const char* data;
+	size_t size;
+
+	uint32_t root = 0;
+	uint32_t stringTable = 0;
+	uint32_t stringCount = 0;
+
+	[[noreturn]] static void fail(const std::string& message)
+	{
+		throw std::runtime_error("malformed AST snapshot: " + message);
+	}
+
+	uint32_t readU32(size_t at) const
+	{
+		if (at + sizeof(uint32_t) > size)
+			fail("read past the end at offset " + std::to_string(at));
 
+		uint32_t value;
+		memcpy(&value, data + at, sizeof(value));
+		return value;
+	}
+public:
+	// a node record and where it was read from; absent when at is 0
+	struct Node
+	{
+		uint32_t at = 0;
+		Snapshot::Node record{};
 
-		if (wasMainEncountered)
+		explicit operator bool() const
 		{
-			buff << "end\n";
+			return at != 0;
 		}
+	};
 
-		return false;
+	struct List
+	{
+		uint32_t at;
+		uint32_t count;
+	};
+private:
+	// children are stored before their parents, so every node read must end
+	// at or before the record that refers to it; this also ends every walk
+	Node node(uint32_t at, uint32_t before) const
+	{
+		if (at < sizeof(Snapshot::Header) || size_t(at) + sizeof(Snapshot::Node) > before)
+			fail("node offset " + std::to_string(at) + " out of order");
+
+		Node result;
+		result.at = at;
+		memcpy(&result.record, data + at, sizeof(result.record));
+
+		if (result.record.kind >= Kind::Count)
+			fail("unknown node kind at offset " + std::to_string(at));
+
+		return result;
 	}
 
-	bool visit(Parser::AstStatIf* ifStat) override
+	Node child(const Node& parent, uint32_t at) const
 	{
-		writeIndent();
-		buff << "if ";
-
-		visitIf(ifStat);
+		return node(at, parent.at);
+	}
 
-		writeIndent();
-		buff << "end\n";
+	Node optionalChild(const Node& parent, uint32_t at) const
+	{
+		return at ? node(at, parent.at) : Node{};
+	}
 
-		// TODO: else and elseif
+	Node function(const Node& parent, uint32_t at) const
+	{
+		auto func = node(at, parent.at);
+		if (func.record.kind != Kind::ExprFunction)
+			fail("expected a function at offset " + std::to_string(at));
 
-		return false;
+		return func;
 	}
 
-	bool visit(Parser::AstStatWhile* whileStat) override
+	List list(const Node& parent, uint32_t at) const
 	{
-		writeIndent();
-		buff << "while ";
-		whileStat->condition->visit(this);
-		buff << " do\n";
+		if (at < sizeof(Snapshot::Header) || size_t(at) + sizeof(uint32_t) > parent.at)
+			fail("list offset " + std::to_string(at) + " out of order");
 
-		indent++;
-		for (const auto& stat : whileStat->body->as<Parser::AstStatBlock>()->body)
-		{
-			stat->visit(this);
-		}
-		indent--;
+		uint32_t count = readU32(at);
+		if (count > (parent.at - at - sizeof(uint32_t)) / sizeof(uint32_t))
+			fail("list at offset " + std::to_string(at) + " overruns its parent");
 
-		writeIndent();
-		buff << "end\n";
+		return { at, count };
+	}
 
-		return false;
+	uint32_t entry(const List& l, size_t i) const
+	{
+		return readU32(size_t(l.at) + sizeof(uint32_t) * (i + 1));
 	}
 
-	bool visit(Parser::AstStatRepeat* repeatStat) override
+	std::string_view string(uint32_t index) const
 	{
-		writeIndent();
-		buff << "repeat\n";
+		if (index >= stringCount)
+			fail("string " + std::to_string(index) + " out of range");
 
-		indent++;
-		for (const auto& stat : repeatStat->body->as<Parser::AstStatBlock>()->body)
-		{
-			stat->visit(this);
-		}
-		indent--;
+		size_t at = size_t(stringTable) + sizeof(uint32_t) + index * 2 * sizeof(uint32_t);
+		uint32_t offset = readU32(at);
+		uint32_t length = readU32(at + sizeof(uint32_t));
 
-		writeIndent();
-		buff << "until ";
-		repeatStat->condition->visit(this);
-		buff << "\n";
+		if (size_t(offset) + length > size)
+			fail("string " + std::to_string(index) + " out of range");
 
-		return false;
+		return { data + offset, length };
+	}
+public:
+	SnapshotSource(const char* data, size_t size)
+		: data(data), size(size)
+	{
+		Snapshot::Header header;
+		if (size < sizeof(header))
+			fail("truncated header");
+
+		memcpy(&header, data, sizeof(header));
+
+		if (header.magic != Snapshot::kMagic)
+			fail("bad magic");
+		if (header.version != Snapshot::kVersion)
+			fail("unsupported version " + std::to_string(header.version));
+		if (header.size != size)
+			fail("image is " + std::to_string(size) + " bytes, header says " + std::to_string(header.size));
+
+		root = header.root;
+		stringTable = header.strings;
+		stringCount = readU32(stringTable);
+		if (stringCount > (size - stringTable - sizeof(uint32_t)) / (2 * sizeof(uint32_t)))
+			fail("string table overruns the image");
 	}
 
-	bool visit(Parser::AstStatBreak* breakStat) override
+	// the root comes before the string table like every other node
+	Node rootNode() const
 	{
-		writeIndent();
-		buff << "break\n";
-		return false;
+		return node(root, stringTable);
 	}
 
-	bool visit(Parser::AstStatReturn* retStat) override
+	Kind kind(const Node& n) const
 	{
-		writeIndent();
-		buff << "return ";
-		for (size_t i = 0; i < retStat->list.size; ++i)
-		{
-			auto expr = retStat->list.data[i];
-			expr->visit(this);
+		return n.record.kind;
+	}
 
-			if (i != retStat->list.size - 1)
-			{
-				buff << ", ";
-			}
-		}
-		buff << "\n";
+	size_t count(const List& l) const
+	{
+		return l.count;
+	}
 
-		return false;
+	Node item(const List& l, size_t i) const
+	{
+		return node(entry(l, i), l.at);
 	}
 
-	bool visit(Parser::AstStatExpr* exprStat) override
+	Node optionalItem(const List& l, size_t i) const
 	{
-		writeIndent();
-		exprStat->expr->visit(this);
-		buff << "\n";
+		uint32_t at = entry(l, i);
+		return at ? node(at, l.at) : Node{};
+	}
+
+	std::string_view nameAt(const List& l, size_t i) const
+	{
+		return string(entry(l, i));
+	}
 
+	bool split(const Node&, uint32_t, OutputBuffer&) const
+	{
 		return false;
 	}
 
-	bool visit(Parser::AstStatLocalFunction* localFuncStat) override
+	Node groupExpr(const Node& n) const { return child(n, n.record.a); }
+	bool boolValue(const Node& n) const { return n.record.op != 0; }
+
+	double numberValue(const Node& n) const
 	{
-		writeIndent();
-		buff << "local function " << localFuncStat->var->name.value << "(";
+		uint32_t bits[2] = { n.record.a, n.record.b };
+		double value;
+		memcpy(&value, bits, sizeof(value));
+		return value;
+	}
 
-		auto funcExpr = localFuncStat->body->as<Parser::AstExprFunction>();
-		for (size_t i = 0; i < funcExpr->args.size; ++i)
-		{
-			auto expr = funcExpr->args.data[i];
-			buff << expr->name.value;
+	std::string_view stringValue(const Node& n) const { return string(n.record.a); }
+	std::string_view localName(const Node& n) const { return string(n.record.a); }
+	std::string_view globalName(const Node& n) const { return string(n.record.a); }
+	Node callFunc(const Node& n) const { return child(n, n.record.a); }
+	List callArgs(const Node& n) const { return list(n, n.record.b); }
+	bool callSelf(const Node& n) const { return n.record.op != 0; }
+	Node indexNameExpr(const Node& n) const { return child(n, n.record.a); }
+	std::string_view indexName(const Node& n) const { return string(n.record.b); }
+	Node indexExpr(const Node& n) const { return child(n, n.record.a); }
+	Node indexKey(const Node& n) const { return child(n, n.record.b); }
+	List functionArgs(const Node& n) const { return list(n, n.record.a); }
+	bool functionVararg(const Node& n) const { return (n.record.op & Snapshot::FunctionVararg) != 0; }
+	bool functionSelf(const Node& n) const { return (n.record.op & Snapshot::FunctionSelf) != 0; }
+	Node functionBody(const Node& n) const { return child(n, n.record.b); }
+
+	List tablePairs(const Node& n) const
+	{
+		auto pairs = list(n, n.record.a);
+		if (pairs.count % 2 != 0)
+			fail("table at offset " + std::to_string(n.at) + " has an odd pair list");
 
-			if (i != funcExpr->args.size - 1)
-			{
-				buff << ", ";
-			}
-		}
-		if (funcExpr->vararg)
-		{
-			if (funcExpr->args.size > 0)
-			{
-				buff << ", ";
-			}
-			buff << "...";
-		}
+		return pairs;
+	}
 
-		buff << ")\n";
+	int unaryOp(const Node& n) const { return n.record.op; }
+	Node unaryExpr(const Node& n) const { return child(n, n.record.a); }
+	int binaryOp(const Node& n) const { return n.record.op; }
+	Node binaryLeft(const Node& n) const { return child(n, n.record.a); }
+	Node binaryRight(const Node& n) const { return child(n, n.record.b); }
 
-		indent++;
-		for (const auto& stat : funcExpr->body->as<Parser::AstStatBlock>()->body)
-		{
-			stat->visit(this);
-		}
-		indent--;
+	List statements(const Node& n) const
+	{
+		if (n.record.kind != Kind::StatBlock)
+			fail("expected a block at offset " + std::to_string(n.at));
 
-		writeIndent();
-		buff << "end\n";
+		return list(n, n.record.a);
+	}
 
-		return false;
+	Node ifCondition(const Node& n) const { return child(n, n.record.a); }
+	Node ifThen(const Node& n) const { return child(n, n.record.b); }
+	Node ifElse(const Node& n) const { return optionalChild(n, n.record.c); }
+	Node whileCondition(const Node& n) const { return child(n, n.record.a); }
+	Node whileBody(const Node& n) const { return child(n, n.record.b); }
+	Node repeatBody(const Node& n) const { return child(n, n.record.a); }
+	Node repeatCondition(const Node& n) const { return child(n, n.record.b); }
+	List returnList(const Node& n) const { return list(n, n.record.a); }
+	Node statExpr(const Node& n) const { return child(n, n.record.a); }
+	List localVars(const Node& n) const { return list(n, n.record.a); }
+	List localValues(const Node& n) const { return list(n, n.record.b); }
+	std::string_view localFunctionName(const Node& n) const { return string(n.record.a); }
+	Node localFunction(const Node& n) const { return function(n, n.record.b); }
+	std::string_view forVar(const Node& n) const { return string(n.record.a); }
+	Node forFrom(const Node& n) const { return child(n, n.record.b); }
+	Node forTo(const Node& n) const { return child(n, n.record.c); }
+	Node forStep(const Node& n) const { return optionalChild(n, n.record.d); }
+	Node forBody(const Node& n) const { return child(n, n.record.e); }
+	List forInVars(const Node& n) const { return list(n, n.record.a); }
+	List forInValues(const Node& n) const { return list(n, n.record.b); }
+	Node forInBody(const Node& n) const { return child(n, n.record.c); }
+	List assignVars(const Node& n) const { return list(n, n.record.a); }
+	List assignValues(const Node& n) const { return list(n, n.record.b); }
+	Node functionTarget(const Node& n) const { return child(n, n.record.a); }
+	Node functionValue(const Node& n) const { return function(n, n.record.b); }
+};
+
+void Luau::formatAst(OutputBuffer& buff, Parser::AstStat* root)
+{
+	try
+	{
+		TreeSource source;
+		CodeEmitter<TreeSource> emitter{ source, buff };
+		emitter.format(root);
+	}
+	catch (...)
+	{
+		std::rethrow_exception(std::current_exception());
 	}
+}
+
+void Luau::formatAstParallel(OutputBuffer& buff, Parser::AstStat* root, unsigned threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	ParallelFormat parallel;
+	parallel.run(buff, root, threads);
+}
+
+void Luau::formatAst(std::ostream& buff, Parser::AstStat* root)
+{
+	OutputBuffer out;
+	formatAst(out, root);
+	buff.write(out.data(), out.size());
+}
 
-	bool visit(Parser::AstStatLocal* localStat) override
+void Luau::formatStatements(OutputBuffer& buff, Parser::AstStat* const* stats, size_t count)
+{
+	TreeSource source;
+	CodeEmitter<TreeSource> emitter{ source, buff, true };
+	for (size_t i = 0; i < count; ++i)
 	{
-		writeIndent();
-		buff << "local ";
-		for (size_t i = 0; i < localStat->vars.size; ++i)
-		{
-			auto expr = localStat->vars.data[i];
-			buff << expr->name.value;
-			localStat->vars.data[i]->utilized = true;
+		emitter.format(stats[i]);
+	}
+}
 
-			if (i != localStat->vars.size - 1)
-			{
-				buff << ", ";
-			}
-		}
+void Luau::formatSnapshot(OutputBuffer& buff, const char* data, size_t size)
+{
+	SnapshotSource source{ data, size };
+	CodeEmitter<SnapshotSource> emitter{ source, buff };
+	emitter.format(source.rootNode());
+}
 
-		if (localStat->values.size > 0)
-		{
-			if (localStat->values.size == 1)
-			{
-				if (localStat->values.data[0]->is<Parser::AstExprConstantNil>())
-				{
-					localStat->vars.data[0]->utilized = true;
-					buff << "\n";
-					return false;
-				}
-			}
-			buff << " = ";
+// Respaces and reindents source one lexeme at a time without parsing it.
+// Line breaks are kept, with runs of blank lines cut to one, and each line
+// is indented once for every line with a block or bracket still open at
+// its start. Like formatCode, it drops comments
+class TokenFormatter
+{
+	using Lexeme = Parser::Lexeme;
 
-			for (size_t i = 0; i < localStat->values.size; ++i)
-			{
-				auto expr = localStat->values.data[i];
-				expr->visit(this);
-				localStat->vars.data[i]->utilized = true;
+	OutputBuffer& buff;
+	const char* source;
 
-				if (i != localStat->values.size - 1)
-				{
-					buff << ", ";
-				}
-			}
-		}
+	// open blocks and brackets, and whether each indents the lines after it;
+	// only the first one opened on a line does
+	std::vector<bool> open;
+	uint32_t level = 0;
+	bool lineIndents = false;
 
-		buff << "\n";
+	// until something other than a closer is on the line its indentation
+	// isn't known, so the closers wait here
+	bool lineStart = true;
+	uint32_t lineLevel = 0;
+	std::string pending;
 
-		return false;
-	}
+	bool first = true;
+	unsigned int line = 0;
 
-	bool visit(Parser::AstStatFor* forStat) override
-	{
-		writeIndent();
-		buff << "for " << forStat->var->name.value << " = ";
-		forStat->from->visit(this);
-		buff << ", ";
-		forStat->to->visit(this);
+	Lexeme::Type previous = Lexeme::Eof;
+	unsigned int previousEnd = 0;
+	bool previousUnary = false;
 
-		if (forStat->step)
+	static bool isOpener(Lexeme::Type type)
+	{
+		switch (int(type))
 		{
-			buff << ", ";
-			forStat->step->visit(this);
+		case Lexeme::ReservedFunction:
+		case Lexeme::ReservedDo:
+		case Lexeme::ReservedThen:
+		case Lexeme::ReservedRepeat:
+		case Lexeme::ReservedElse:
+		case '(':
+		case '[':
+		case '{':
+			return true;
+		default:
+			return false;
 		}
+	}
 
-		buff << " do\n";
-
-		indent++;
-		for (const auto& stat : forStat->body->as<Parser::AstStatBlock>()->body)
+	static bool isCloser(Lexeme::Type type)
+	{
+		switch (int(type))
 		{
-			stat->visit(this);
+		case Lexeme::ReservedEnd:
+		case Lexeme::ReservedUntil:
+		case Lexeme::ReservedElse:
+		case Lexeme::ReservedElseif:
+		case ')':
+		case ']':
+		case '}':
+			return true;
+		default:
+			return false;
 		}
-		indent--;
-
-		writeIndent();
-		buff << "end\n";
-
-		return false;
 	}
 
-	bool visit(Parser::AstStatForIn* forInStat) override
+	// what can end an expression, so that a '-' after it is binary
+	static bool isOperandEnd(Lexeme::Type type)
 	{
-		writeIndent();
-		buff << "for ";
-		for (size_t i = 0; i < forInStat->vars.size; ++i)
+		switch (int(type))
 		{
-			auto expr = forInStat->vars.data[i];
-			buff << expr->name.value;
-
-			if (i != forInStat->vars.size - 1)
-			{
-				buff << ", ";
-			}
+		case Lexeme::Name:
+		case Lexeme::Number:
+		case Lexeme::String:
+		case Lexeme::Dot3:
+		case Lexeme::ReservedNil:
+		case Lexeme::ReservedTrue:
+		case Lexeme::ReservedFalse:
+		case Lexeme::ReservedEnd:
+		case ')':
+		case ']':
+		case '}':
+			return true;
+		default:
+			return false;
 		}
+	}
 
-		buff << " in ";
+	// what a call or an index can follow
+	static bool isPrefixEnd(Lexeme::Type type)
+	{
+		return type == Lexeme::Name || type == Lexeme::String || type == ')' || type == ']' || type == '}';
+	}
 
-		for (size_t i = 0; i < forInStat->values.size; ++i)
+	bool needsSpace(Lexeme::Type type, unsigned int offset) const
+	{
+		switch (int(type))
 		{
-			auto expr = forInStat->values.data[i];
-			expr->visit(this);
-
-			if (i != forInStat->values.size - 1)
-			{
-				buff << ", ";
-			}
+		case ')':
+		case ']':
+		case '}':
+		case ',':
+		case ';':
+		case '.':
+		case ':':
+			return false;
+		default:
+			break;
 		}
 
-		buff << " do\n";
-
-		indent++;
-		for (const auto& stat : forInStat->body->as<Parser::AstStatBlock>()->body)
+		switch (int(previous))
 		{
-			stat->visit(this);
+		case '(':
+		case '{':
+		case '.':
+		case ':':
+			return false;
+		case '[':
+			// "[[" would start a long string
+			return source[offset] == '[';
+		case ',':
+		case ';':
+			return true;
+		default:
+			break;
 		}
-		indent--;
 
-		writeIndent();
-		buff << "end\n";
+		// "--" would start a comment
+		if (previousUnary)
+			return previous == '-' && type == '-';
 
-		return false;
+		if (type == '(')
+			return !isPrefixEnd(previous) && previous != Lexeme::ReservedFunction;
+
+		if (type == '[')
+			return !isPrefixEnd(previous);
+
+		// f{...} and f"..." calls keep their spacing
+		if ((type == '{' || type == Lexeme::String) && isPrefixEnd(previous))
+			return previousEnd != offset;
+
+		return true;
 	}
 
-	bool visit(Parser::AstStatFunction* funcStat) override
+	void emit(const char* data, size_t size)
 	{
-		writeIndent();
-		auto funcExpr = funcStat->body->as<Parser::AstExprFunction>();
+		if (lineStart)
+			pending.append(data, size);
+		else
+			buff.write(data, size);
+	}
 
-		buff << "function ";
-		if (funcExpr->self && funcStat->expr->is<Parser::AstExprIndexName>())
-		{
-			auto indexNameExpr = funcStat->expr->as<Parser::AstExprIndexName>();
+	void startLine()
+	{
+		buff.writeIndent(lineLevel);
+		buff.write(pending.data(), pending.size());
+		pending.clear();
 
-			indexNameExpr->expr->visit(this);
-			buff << ":" << indexNameExpr->index.value;
-		}
-		else
-		{
-			funcStat->expr->visit(this);
-		}
+		lineStart = false;
+	}
+
+	void newLine(unsigned int next)
+	{
+		if (lineStart)
+			startLine();
 
-		buff << "(";
+		buff.put('\n');
+		if (next > line + 1)
+			buff.put('\n');
 
+		lineStart = true;
+		lineLevel = level;
+		lineIndents = false;
+	}
 
-		for (size_t i = 0; i < funcExpr->args.size; ++i)
-		{
-			auto expr = funcExpr->args.data[i];
-			buff << expr->name.value;
+	void openBlock()
+	{
+		open.push_back(!lineIndents);
 
-			if (i != funcExpr->args.size - 1)
-			{
-				buff << ", ";
-			}
-		}
-		if (funcExpr->vararg)
+		if (!lineIndents)
 		{
-			if (funcExpr->args.size > 0)
-			{
-				buff << ", ";
-			}
-			buff << "...";
+			level++;
+			lineIndents = true;
 		}
+	}
 
-		buff << ")\n";
+	void closeBlock()
+	{
+		if (open.empty())
+			return;
 
-		indent++;
-		for (const auto& stat : funcExpr->body->as<Parser::AstStatBlock>()->body)
+		if (open.back())
 		{
-			stat->visit(this);
+			level--;
+			lineIndents = false;
 		}
-		indent--;
 
-		writeIndent();
-		buff << "end\n";
+		open.pop_back();
 
-		return false;
+		if (lineStart)
+			lineLevel = level;
+	}
+public:
+	TokenFormatter(OutputBuffer& buff, const char* source)
+		: buff(buff)
+		, source(source)
+	{
 	}
 
-	bool visit(Parser::AstStatAssign* assignStat) override
+	void write(const Lexeme& lexeme, unsigned int offset, unsigned int end)
 	{
-		writeIndent();
-		for (size_t i = 0; i < assignStat->vars.size; ++i)
-		{
-			auto expr = assignStat->vars.data[i];
-			expr->visit(this);
+		Lexeme::Type type = lexeme.type;
 
-			if (i != assignStat->vars.size - 1)
-			{
-				buff << ", ";
-			}
-		}
+		if (!first && lexeme.location.begin.line != line)
+			newLine(lexeme.location.begin.line);
+		else if (!first && needsSpace(type, offset))
+			emit(" ", 1);
 
-		buff << " = ";
+		if (isCloser(type))
+			closeBlock();
+		else if (lineStart)
+			startLine();
 
-		for (size_t i = 0; i < assignStat->values.size; ++i)
-		{
-			auto expr = assignStat->values.data[i];
-			expr->visit(this);
+		emit(source + offset, end - offset);
 
-			if (i != assignStat->values.size - 1)
-			{
-				buff << ", ";
-			}
-		}
+		if (isOpener(type))
+			openBlock();
 
-		buff << "\n";
+		previousUnary = (type == '-' && !isOperandEnd(previous)) || type == '#';
+		previous = type;
+		previousEnd = end;
 
-		return false;
+		line = lexeme.location.end.line;
+		first = false;
+	}
+
+	void finish()
+	{
+		if (first)
+			return;
+
+		if (lineStart)
+			startLine();
+
+		buff.put('\n');
 	}
 };
 
-void Luau::formatAst(std::ostream& buff, Parser::AstStat* root)
+void Luau::formatCode(OutputBuffer& buff, const std::string& source)
 {
 	try
 	{
-		CodeVisitor visitor{ buff };
-		root->visit(&visitor);
+		Parser::Allocator a;
+		Parser::AstNameTable names{ a };
+		Parser::AstStat* root =
+			Parser::parse(source.data(), source.size(), names, a);
+
+		TreeSource source;
+		CodeEmitter<TreeSource> emitter{ source, buff };
+		emitter.format(root);
 	}
 	catch (...)
 	{
@@ -828,20 +1735,65 @@ void Luau::formatAst(std::ostream& buff, Parser::AstStat* root)
 	}
 }
 
-void Luau::formatCode(std::ostream& buff, const std::string& source)
+// hands each statement a streaming parse reports to a CodeEmitter
+class StatementEmitter : public Parser::AstVisitor
+{
+	CodeEmitter<TreeSource>& emitter;
+public:
+	StatementEmitter(CodeEmitter<TreeSource>& emitter)
+		: emitter(emitter)
+	{
+	}
+
+	bool visit(Parser::AstStat* stat) override
+	{
+		emitter.format(stat);
+		return false;
+	}
+};
+
+void Luau::formatCodeStreaming(OutputBuffer& buff, const std::string& source)
 {
 	try
 	{
+		// names outlive every statement, so they can't share the arena
+		Parser::Allocator namesAllocator;
+		Parser::AstNameTable names{ namesAllocator };
+
 		Parser::Allocator a;
-		Parser::AstNameTable names{ a };
-		Parser::AstStat* root =
-			Parser::parse(source.data(), source.size(), names, a);
+		TreeSource tree;
+		CodeEmitter<TreeSource> emitter{ tree, buff, true };
+		StatementEmitter visitor{ emitter };
 
-		CodeVisitor visitor{ buff };
-		root->visit(&visitor);
+		size_t count = Parser::parseStreaming(source.data(), source.size(), names, a, visitor);
+
+		// formatAst writes a lone space for an empty main block
+		if (count == 0)
+			buff << ' ';
 	}
 	catch (...)
 	{
 		std::rethrow_exception(std::current_exception());
 	}
 }
+
+void Luau::formatTokens(OutputBuffer& buff, const std::string& source)
+{
+	Parser::Allocator a;
+	Parser::AstNameTable names{ a };
+	Parser::LexemeStream lexemes{ source.data(), source.size(), names, a };
+
+	TokenFormatter formatter{ buff, source.data() };
+
+	for (; lexemes.current().type != Parser::Lexeme::Eof; lexemes.next())
+		formatter.write(lexemes.current(), lexemes.offset(), lexemes.endOffset());
+
+	formatter.finish();
+}
+
+void Luau::formatCode(std::ostream& buff, const std::string& source)
+{
+	OutputBuffer out;
+	formatCode(out, source);
+	buff.write(out.data(), out.size());
+}
@@ -1,10 +1,30 @@
 #pragma once
+#include "OutputBuffer.h"
 #include "Parser.h"
 
 #include <ostream>
 
 namespace Luau
 {
+	void formatAst(OutputBuffer& buff, Parser::AstStat* root);
 	void formatAst(std::ostream& buff, Parser::AstStat* root);
+	// formats large function bodies on separate threads (0 picks one per
+	// core); the output is byte-identical to formatAst
+	void formatAstParallel(OutputBuffer& buff, Parser::AstStat* root, unsigned threads = 0);
+	// formats statements of the main block one batch at a time, producing
+	// the same text formatAst prints for them
+	void formatStatements(OutputBuffer& buff, Parser::AstStat* const* stats, size_t count);
+	void formatCode(OutputBuffer& buff, const std::string& source);
 	void formatCode(std::ostream& buff, const std::string& source);
+	// formatCode that parses and writes one top-level statement at a time,
+	// so memory is bounded by the largest statement plus the distinct names
+	// used, not the size of the source. output written before a syntax
+	// error is not taken back
+	void formatCodeStreaming(OutputBuffer& buff, const std::string& source);
+	// normalizes spacing and indentation from the lexemes alone, without
+	// parsing; line breaks are kept and comments dropped. the lexer interns
+	// every distinct name, so memory grows with the names used rather than
+	// with the source. a lexing error throws after the lines before it were
+	// written
+	void formatTokens(OutputBuffer& buff, const std::string& source);
 }
@@ -7,7 +7,20 @@
 #include <iostream>
 #include <iomanip>
 #include <stack>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
 #include "CodeFormat.h"
+#include "AstSnapshot.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DECOMPILER_SSE2 1
+#include <emmintrin.h>
+#endif
 
 template <typename T>
 class TempVector
@@ -64,6 +77,15 @@ class BytecodeReader
 {
 	const std::vector<byte>& bytecode;
 	size_t pointer = 0;
+
+	void require(size_t count, size_t elementSize = 1)
+	{
+		if (count > (bytecode.size() - pointer) / elementSize)
+		{
+			throw std::runtime_error("malformed bytecode: unexpected end at offset "
+				+ std::to_string(pointer));
+		}
+	}
 public:
 	BytecodeReader(const std::vector<byte>& bytecode)
 		: bytecode(bytecode) {}
@@ -75,6 +97,13 @@ public:
 		byte readByte;
 		do
 		{
+			if (i > 28)
+			{
+				throw std::runtime_error("malformed bytecode: integer too long at offset "
+					+ std::to_string(pointer));
+			}
+
+			require(1);
 			readByte = *(bytecode.data() + pointer++);
 			res |= (readByte & 0x7F) << i;
 			i += 7;
@@ -83,10 +112,26 @@ public:
 		return res;
 	}
 
+	// an element count, each element taking at least elementSize bytes
+	size_t readCount(size_t elementSize = 1)
+	{
+		auto offset = pointer;
+		auto count = readInt();
+		if (count < 0 || size_t(count) > (bytecode.size() - pointer) / elementSize)
+		{
+			throw std::runtime_error("malformed bytecode: count " + std::to_string(count)
+				+ " at offset " + std::to_string(offset) + " exceeds the input");
+		}
+
+		return size_t(count);
+	}
+
 	template<typename T>
 	T read()
 	{
-		auto res = *(T*)(bytecode.data() + pointer);
+		require(1, sizeof(T));
+		T res;
+		memcpy(&res, bytecode.data() + pointer, sizeof(T));
 		pointer += sizeof(T);
 		return res;
 	}
@@ -94,6 +139,8 @@ public:
 	template<typename T>
 	const T* read(size_t c)
 	{
+		require(c, sizeof(T));
+
 		auto res = (T*)(bytecode.data() + pointer);
 		pointer += sizeof(T) * c;
 		return res;
@@ -197,6 +244,128 @@ struct Instruction
 	};
 };
 
+// Whether the instruction is followed by an aux word in the code stream.
+static bool hasAux(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::GetGlobal:
+	case OpCode::SetGlobal:
+	case OpCode::GetGlobalConst:
+	case OpCode::GetTableIndexConstant:
+	case OpCode::SetTableIndexConstant:
+	case OpCode::Self:
+	case OpCode::Equal:
+	case OpCode::LesserOrEqual:
+	case OpCode::LesserThan:
+	case OpCode::NotEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterOrEqual:
+	case OpCode::NewTable:
+	case OpCode::SetList:
+	case OpCode::TForLoop:
+	case OpCode::LoadConstLarge:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// An instruction with its aux word attached and its jump resolved.
+struct DecodedInstruction
+{
+	OpCode op;
+	byte a;
+	union
+	{
+		struct
+		{
+			byte b;
+			byte c;
+		};
+		uint16_t b_x;
+		int16_t s_b_x;
+	};
+
+	// the aux word; for Closure, the index of its first capture
+	uint32_t aux;
+
+	// first code word of the instruction, for line info
+	uint32_t offset;
+
+	// index of the instruction branched to, the instruction count for the end
+	// of the proto, DecodedCode::kNoTarget when there is none
+	uint32_t target;
+};
+
+struct Proto;
+
+// The code of a proto decoded once after loading, so passes index
+// instructions directly instead of stepping over aux words.
+class DecodedCode
+{
+public:
+	static constexpr uint32_t kNoTarget = ~uint32_t(0);
+
+	struct Sources
+	{
+		const uint32_t* first;
+		const uint32_t* last;
+
+		const uint32_t* begin() const
+		{
+			return first;
+		}
+
+		const uint32_t* end() const
+		{
+			return last;
+		}
+	};
+
+	void decode(const Proto* p);
+
+	size_t size() const
+	{
+		return instructions.size();
+	}
+
+	bool empty() const
+	{
+		return instructions.empty();
+	}
+
+	const DecodedInstruction& operator[](size_t i) const
+	{
+		return instructions[i];
+	}
+
+	// instructions that branch to the instruction at i
+	Sources sources(size_t i) const
+	{
+		auto data = sourceData.data();
+		return { data + sourceOffsets[i], data + sourceOffsets[i + 1] };
+	}
+
+	// the capture pseudo-instructions following a Closure
+	const Instruction* captures(const DecodedInstruction& instr) const
+	{
+		return captureData.data() + instr.aux;
+	}
+
+	// whether an aux word was cut off or a jump did not land on an instruction
+	bool malformed() const
+	{
+		return isMalformed;
+	}
+private:
+	std::vector<DecodedInstruction> instructions;
+	std::vector<uint32_t> sourceOffsets;
+	std::vector<uint32_t> sourceData;
+	std::vector<Instruction> captureData;
+	bool isMalformed = false;
+};
+
 enum class ConstantType : byte
 {
 	ConstantNil,
@@ -219,11 +388,371 @@ struct Proto
 	std::vector<Proto*> children;
 	std::string_view name;
 	std::vector<size_t> lineInfo;
-	std::vector<Luau::Parser::AstLocal*> args;
-	std::vector<Luau::Parser::AstLocal*> upvalues;
 	bool isMain = false;
+
+	DecodedCode decoded;
 };
 
+void DecodedCode::decode(const Proto* p)
+{
+	const auto& code = p->code;
+	auto n = code.size();
+
+	instructions.clear();
+	captureData.clear();
+	isMalformed = false;
+
+	// code word -> instruction index, n maps to the end of the proto
+	std::vector<uint32_t> wordIndex(n + 1, kNoTarget);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		auto instr = code[i];
+
+		DecodedInstruction decoded{};
+		decoded.op = instr.op;
+		decoded.a = instr.a;
+		decoded.b_x = instr.b_x;
+		decoded.offset = uint32_t(i);
+		decoded.target = kNoTarget;
+
+		wordIndex[i] = uint32_t(instructions.size());
+
+		if (hasAux(instr.op))
+		{
+			if (i + 1 < n)
+				decoded.aux = code[++i].encoded;
+			else
+				isMalformed = true;
+		}
+		else if (instr.op == OpCode::Closure)
+		{
+			decoded.aux = uint32_t(captureData.size());
+
+			byte upvalCount = 0;
+			if (instr.b_x < p->children.size())
+				upvalCount = p->children[instr.b_x]->upvalCount;
+
+			for (byte j = 0; j < upvalCount; ++j)
+			{
+				if (i + 1 < n)
+				{
+					captureData.push_back(code[++i]);
+				}
+				else
+				{
+					// keeps captures() in bounds for the handler
+					captureData.push_back({});
+					isMalformed = true;
+				}
+			}
+		}
+
+		instructions.push_back(decoded);
+	}
+
+	wordIndex[n] = uint32_t(instructions.size());
+
+	for (auto& instr : instructions)
+	{
+		ptrdiff_t target;
+		switch (instr.op)
+		{
+		case OpCode::LoadBool:
+			if (!instr.c)
+				continue;
+			target = ptrdiff_t(instr.offset) + 1 + instr.c;
+			break;
+		case OpCode::Jump:
+		case OpCode::Test:
+		case OpCode::NotTest:
+		case OpCode::Equal:
+		case OpCode::LesserOrEqual:
+		case OpCode::LesserThan:
+		case OpCode::NotEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterOrEqual:
+			target = ptrdiff_t(instr.offset) + 1 + instr.s_b_x;
+			break;
+		case OpCode::LoopJump:
+			// the body starts at offset + d, matching the LoopJump handler
+			target = ptrdiff_t(instr.offset) + instr.s_b_x;
+			break;
+		default:
+			continue;
+		}
+
+		if (target >= 0 && size_t(target) <= n && wordIndex[target] != kNoTarget)
+			instr.target = wordIndex[target];
+		else
+			isMalformed = true;
+	}
+
+	// reverse index, CSR layout
+	sourceOffsets.assign(instructions.size() + 2, 0);
+	for (const auto& instr : instructions)
+	{
+		if (instr.target != kNoTarget)
+			sourceOffsets[instr.target + 1]++;
+	}
+
+	for (size_t i = 0; i + 1 < sourceOffsets.size(); ++i)
+		sourceOffsets[i + 1] += sourceOffsets[i];
+
+	sourceData.resize(sourceOffsets.back());
+	std::vector<uint32_t> fill(sourceOffsets.begin(), sourceOffsets.end() - 1);
+	for (uint32_t i = 0; i < instructions.size(); ++i)
+	{
+		const auto& instr = instructions[i];
+		if (instr.target != kNoTarget)
+			sourceData[fill[instr.target]++] = i;
+	}
+}
+
+// Closures nested deeper than this are rejected instead of recursing in
+// decompile().
+constexpr size_t kMaxProtoDepth = 200;
+
+// Checks everything the decompiler indexes without checking: register,
+// constant, upvalue and child operands, aux words, jump targets and line
+// info. Throws with the offending instruction on the first problem.
+static void validateProto(const Proto* p, size_t protoIndex)
+{
+	const auto& code = p->decoded;
+
+	std::string where = "malformed bytecode: proto " + std::to_string(protoIndex);
+
+	auto fail = [&](size_t pc, const std::string& message)
+	{
+		const auto& instr = code[pc];
+		throw std::runtime_error(where + ", instruction " + std::to_string(pc)
+			+ " (offset " + std::to_string(instr.offset) + ", opcode "
+			+ std::to_string(byte(instr.op)) + "): " + message);
+	};
+
+	if (code.empty())
+		throw std::runtime_error(where + ": no code");
+
+	// registers [first, last] must exist in the frame
+	auto checkRange = [&](size_t pc, size_t first, size_t last)
+	{
+		if (first > last)
+		{
+			fail(pc, "empty register range " + std::to_string(first) + ".."
+				+ std::to_string(last));
+		}
+
+		if (last >= p->maxRegCount)
+		{
+			fail(pc, "register " + std::to_string(last) + " out of range (maxRegCount "
+				+ std::to_string(p->maxRegCount) + ")");
+		}
+	};
+
+	auto checkRegister = [&](size_t pc, size_t reg)
+	{
+		checkRange(pc, reg, reg);
+	};
+
+	auto checkConstant = [&](size_t pc, size_t index, bool string)
+	{
+		if (index >= p->constants.size())
+		{
+			fail(pc, "constant " + std::to_string(index) + " out of range ("
+				+ std::to_string(p->constants.size()) + " constants)");
+		}
+
+		if (string && !p->constants[index]->is<Luau::Parser::AstExprConstantString>())
+			fail(pc, "constant " + std::to_string(index) + " is not a string");
+	};
+
+	auto checkUpvalue = [&](size_t pc, size_t index)
+	{
+		if (index >= p->upvalCount)
+		{
+			fail(pc, "upvalue " + std::to_string(index) + " out of range ("
+				+ std::to_string(p->upvalCount) + " upvalues)");
+		}
+	};
+
+	auto checkTarget = [&](size_t pc)
+	{
+		if (code[pc].target == DecodedCode::kNoTarget)
+		{
+			fail(pc, "jump offset " + std::to_string(code[pc].s_b_x)
+				+ " does not land on an instruction");
+		}
+	};
+
+	// whether the last multiple-result call or varargs has not been consumed
+	bool openTop = false;
+
+	for (size_t pc = 0; pc < code.size(); ++pc)
+	{
+		const auto& instr = code[pc];
+
+		if (byte(instr.op) >= byte(OpCode::OPCODE_END))
+			fail(pc, "unknown opcode");
+
+		if (hasAux(instr.op) && instr.offset + 1 >= p->code.size())
+			fail(pc, "missing aux word");
+
+		switch (instr.op)
+		{
+		case OpCode::LoadBool:
+			checkRegister(pc, instr.a);
+			if (instr.c)
+				checkTarget(pc);
+			break;
+		case OpCode::LoadNil:
+		case OpCode::LoadShort:
+		case OpCode::NewTable:
+		case OpCode::NewTableConst:
+		case OpCode::SetList:
+			checkRegister(pc, instr.a);
+			break;
+		case OpCode::LoadConst:
+		case OpCode::GetGlobalConst:
+			checkRegister(pc, instr.a);
+			checkConstant(pc, instr.b_x, false);
+			break;
+		case OpCode::GetGlobal:
+		case OpCode::SetGlobal:
+			checkRegister(pc, instr.a);
+			checkConstant(pc, instr.aux, true);
+			break;
+		case OpCode::GetUpvalue:
+		case OpCode::SetUpvalue:
+			checkRegister(pc, instr.a);
+			checkUpvalue(pc, instr.b);
+			break;
+		case OpCode::Move:
+		case OpCode::GetTableIndexByte:
+		case OpCode::SetTableIndexByte:
+		case OpCode::Not:
+		case OpCode::UnaryMinus:
+		case OpCode::Len:
+		case OpCode::OrByte:
+		case OpCode::AndByte:
+			checkRegister(pc, instr.a);
+			checkRegister(pc, instr.b);
+			break;
+		case OpCode::GetTableIndex:
+		case OpCode::SetTableIndex:
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Div:
+		case OpCode::Mod:
+		case OpCode::Pow:
+		case OpCode::Or:
+		case OpCode::And:
+			checkRegister(pc, instr.a);
+			checkRegister(pc, instr.b);
+			checkRegister(pc, instr.c);
+			break;
+		case OpCode::AddByte:
+		case OpCode::SubByte:
+		case OpCode::MulByte:
+		case OpCode::DivByte:
+		case OpCode::ModByte:
+		case OpCode::PowByte:
+			checkRegister(pc, instr.a);
+			checkRegister(pc, instr.b);
+			checkConstant(pc, instr.c, false);
+			break;
+		case OpCode::GetTableIndexConstant:
+		case OpCode::SetTableIndexConstant:
+			checkRegister(pc, instr.a);
+			checkRegister(pc, instr.b);
+			checkConstant(pc, instr.aux, false);
+			break;
+		case OpCode::Self:
+			checkRange(pc, instr.a, instr.a + 1);
+			checkRegister(pc, instr.b);
+			checkConstant(pc, instr.aux, true);
+			break;
+		case OpCode::Closure:
+		{
+			checkRegister(pc, instr.a);
+			if (instr.b_x >= p->children.size())
+			{
+				fail(pc, "child proto " + std::to_string(instr.b_x) + " out of range ("
+					+ std::to_string(p->children.size()) + " children)");
+			}
+
+			auto upvalCount = p->children[instr.b_x]->upvalCount;
+			if (instr.offset + upvalCount >= p->code.size())
+				fail(pc, "missing upvalue captures");
+
+			auto captures = code.captures(instr);
+			for (byte j = 0; j < upvalCount; ++j)
+			{
+				if (captures[j].op == OpCode::Move)
+					checkRegister(pc, captures[j].b);
+				else if (captures[j].op == OpCode::GetUpvalue)
+					checkUpvalue(pc, captures[j].b);
+				else
+					fail(pc, "capture " + std::to_string(j) + " is not a register or upvalue");
+			}
+			break;
+		}
+		case OpCode::Call:
+			checkRegister(pc, instr.a);
+			if (instr.b)
+				checkRange(pc, instr.a, instr.a + instr.b - 1);
+			else if (!openTop)
+				fail(pc, "variable arguments without a preceding multiple-result call");
+			else
+				openTop = false;
+
+			if (instr.c)
+				checkRange(pc, instr.a, instr.a + std::max(instr.c, byte(2)) - 2);
+			else
+				openTop = true;
+			break;
+		case OpCode::Return:
+			if (instr.b > 1)
+				checkRange(pc, instr.a, instr.a + instr.b - 2);
+			else if (instr.b == 0 && !openTop)
+				fail(pc, "variable results without a preceding multiple-result call");
+			else if (instr.b == 0)
+				openTop = false;
+			break;
+		case OpCode::LoadVarargs:
+			if (instr.b > 1)
+				checkRange(pc, instr.a, instr.a + instr.b - 2);
+			else if (instr.b == 0)
+				openTop = true;
+			break;
+		case OpCode::Concat:
+			checkRegister(pc, instr.a);
+			checkRange(pc, instr.b, instr.c);
+			break;
+		case OpCode::Jump:
+		case OpCode::LoopJump:
+			checkTarget(pc);
+			break;
+		case OpCode::Test:
+		case OpCode::NotTest:
+			checkRegister(pc, instr.a);
+			checkTarget(pc);
+			break;
+		case OpCode::Equal:
+		case OpCode::LesserOrEqual:
+		case OpCode::LesserThan:
+		case OpCode::NotEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterOrEqual:
+			checkRegister(pc, instr.a);
+			checkRegister(pc, instr.aux & 0xFF);
+			checkTarget(pc);
+			break;
+		default:;
+		}
+	}
+}
+
 struct LocalData
 {
 	// statement that defines the local - currently unneeded
@@ -232,11 +761,92 @@ struct LocalData
 	std::vector<Luau::Parser::AstStat*> references;
 };
 
+using LocalInfo = phmap::flat_hash_map<Luau::Parser::AstLocal*, LocalData>;
+
+// Locals referenced inside a block but declared outside of it, together with
+// the statements referencing them. Outer passes merge this instead of walking
+// the nested statements again.
+struct BlockSummary
+{
+	LocalInfo freeLocals;
+};
+
+class BlockSummaryCache
+{
+	phmap::flat_hash_map<Luau::Parser::AstStatBlock*, BlockSummary> summaries;
+
+	// innermost summarized block of every statement, and the enclosing blocks
+	// of every summarized block; used to drop stale summaries after a rewrite.
+	// a function body shared by several closure sites has several parents
+	phmap::flat_hash_map<Luau::Parser::AstStat*, Luau::Parser::AstStatBlock*> statBlocks;
+	phmap::flat_hash_map<Luau::Parser::AstStatBlock*, std::vector<Luau::Parser::AstStatBlock*>> parentBlocks;
+public:
+	const BlockSummary& get(Luau::Parser::AstStatBlock* block);
+
+	const BlockSummary* find(Luau::Parser::AstStatBlock* block) const
+	{
+		auto it = summaries.find(block);
+		return it != summaries.cend() ? &it->second : nullptr;
+	}
+
+	void invalidate(Luau::Parser::AstStatBlock* block)
+	{
+		summaries.erase(block);
+
+		std::vector<Luau::Parser::AstStatBlock*> stale{ block };
+		while (!stale.empty())
+		{
+			auto it = parentBlocks.find(stale.back());
+			stale.pop_back();
+
+			if (it == parentBlocks.cend())
+				continue;
+
+			for (auto parent : it->second)
+			{
+				// a summary is only built after those of its children, so a
+				// parent without one has no summarized ancestors left to drop
+				if (summaries.erase(parent))
+					stale.push_back(parent);
+			}
+		}
+	}
+
+	void invalidate(Luau::Parser::AstStat* stat)
+	{
+		auto it = statBlocks.find(stat);
+		if (it != statBlocks.cend())
+			invalidate(it->second);
+	}
+
+	void clear()
+	{
+		summaries.clear();
+		statBlocks.clear();
+		parentBlocks.clear();
+	}
+};
+
 class LocalCollector : public Luau::Parser::AstVisitor
 {
+	BlockSummaryCache& summaries;
 	Luau::Parser::AstStat* context = nullptr;
+
+	void declare(Luau::Parser::AstStat* node, Luau::Parser::AstLocal* local)
+	{
+		context = node;
+		declared.insert(local);
+	}
 public:
-	std::unordered_map<Luau::Parser::AstLocal*, LocalData> localInfo;
+	LocalCollector(BlockSummaryCache& summaries)
+		: summaries(summaries) {};
+
+	LocalInfo localInfo;
+
+	// locals declared by the visited statements and nested blocks reached
+	// from them; only needed when summarizing a block
+	phmap::flat_hash_set<Luau::Parser::AstLocal*> declared;
+	std::vector<Luau::Parser::AstStatBlock*> children;
 
 	bool visit(Luau::Parser::AstExprLocal* node) override
 	{
@@ -253,19 +863,112 @@ public:
 		context = node;
 		return true;
 	}
+
+	bool visit(Luau::Parser::AstStatBlock* node) override
+	{
+		children.push_back(node);
+
+		for (const auto& [local, data] : summaries.get(node).freeLocals)
+		{
+			auto& references = localInfo[local].references;
+			references.insert(references.end(),
+				data.references.cbegin(), data.references.cend());
+		}
+		return false;
+	}
+
+	bool visit(Luau::Parser::AstStatLocal* node) override
+	{
+		for (auto local : node->vars)
+			declare(node, local);
+		return true;
+	}
+
+	bool visit(Luau::Parser::AstStatLocalFunction* node) override
+	{
+		declare(node, node->var);
+		return true;
+	}
+
+	bool visit(Luau::Parser::AstStatFor* node) override
+	{
+		declare(node, node->var);
+		return true;
+	}
+
+	bool visit(Luau::Parser::AstStatForIn* node) override
+	{
+		for (auto local : node->vars)
+			declare(node, local);
+		return true;
+	}
 };
 
+const BlockSummary& BlockSummaryCache::get(Luau::Parser::AstStatBlock* block)
+{
+	auto it = summaries.find(block);
+	if (it != summaries.end())
+		return it->second;
+
+	LocalCollector collector{ *this };
+	for (auto stat : block->body)
+	{
+		statBlocks[stat] = block;
+		stat->visit(&collector);
+	}
+
+	for (auto child : collector.children)
+	{
+		auto& parents = parentBlocks[child];
+		if (std::find(parents.cbegin(), parents.cend(), block) == parents.cend())
+			parents.push_back(block);
+	}
+
+	BlockSummary summary{};
+	for (auto& [local, data] : collector.localInfo)
+	{
+		if (!collector.declared.count(local))
+			summary.freeLocals.emplace(local, std::move(data));
+	}
+
+	return summaries[block] = std::move(summary);
+}
+
 #define VISIT_CHILD(memRef) { nodeRef = &memRef; memRef->visit(this); }
 
-class LocalInliner : public Luau::Parser::AstVisitor
+// Rewrites references to locals in place; subclasses decide what a
+// reference is replaced with.
+class LocalRewriter : public Luau::Parser::AstVisitor
 {
-	Luau::Parser::AstLocal* find;
-	Luau::Parser::AstExprLocal* found;
-	
-	Luau::Parser::AstExpr* replace;
+	std::vector<Luau::Parser::AstStatBlock*> blockStack;
+
+	void visitBody(Luau::Parser::AstStat* body)
+	{
+		auto block = body->as<Luau::Parser::AstStatBlock>();
+
+		if (summaries)
+		{
+			auto summary = summaries->find(block);
+			if (summary && !mayReference(*summary))
+				return;
+		}
+
+		blockStack.push_back(block);
+		for (auto stat : block->body)
+		{
+			stat->visit(this);
+		}
+		blockStack.pop_back();
+	}
+protected:
+	virtual Luau::Parser::AstExpr* substitute(Luau::Parser::AstLocal* local) = 0;
+
+	// whether a block with this summary can contain a reference to rewrite
+	virtual bool mayReference(const BlockSummary& summary) = 0;
 public:
-	LocalInliner(Luau::Parser::AstLocal* find, Luau::Parser::AstExpr* replace)
-		: find(find), replace(replace) {};
+	// summaries consulted to skip nested blocks, and dropped for blocks
+	// that get rewritten
+	BlockSummaryCache* summaries = nullptr;
 
 	Luau::Parser::AstExpr** nodeRef = nullptr;
 	size_t inlineCount = 0;
@@ -296,10 +999,13 @@ public:
 
 	virtual bool visit(Luau::Parser::AstExprLocal* node)
 	{
-		if (node->local == find)
+		if (auto replace = substitute(node->local))
 		{
 			*nodeRef = replace;
 			inlineCount++;
+
+			if (summaries && !blockStack.empty())
+				summaries->invalidate(blockStack.back());
 		}
 		return false;
 	}
@@ -336,90 +1042,1369 @@ public:
 	virtual bool visit(Luau::Parser::AstStatIf* node)
 	{
 		VISIT_CHILD(node->condition);
-		for (auto stat : node->thenbody->as<Luau::Parser::AstStatBlock>()->body)
+		visitBody(node->thenbody);
+
+		if (node->elsebody)
+		{
+			visitBody(node->elsebody);
+		}
+
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatWhile* node)
+	{
+		VISIT_CHILD(node->condition);
+		visitBody(node->body);
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatRepeat* node)
+	{
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatBreak* node)
+	{
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatReturn* node)
+	{
+		for (size_t i = 0; i < node->list.size; ++i)
+		{
+			VISIT_CHILD(node->list.data[i]);
+		}
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatExpr* node)
+	{
+		VISIT_CHILD(node->expr);
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatLocal* localStat)
+	{
+		for (size_t i = 0; i < localStat->values.size; ++i)
+		{
+			VISIT_CHILD(localStat->values.data[i]);
+		}
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatFor* node)
+	{
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatForIn* node)
+	{
+		return false;
+	}
+
+	virtual bool visit(Luau::Parser::AstStatAssign* assignStat)
+	{
+		for (size_t i = 0; i < assignStat->values.size; ++i)
+		{
+			VISIT_CHILD(assignStat->values.data[i])
+		}
+
+		for (size_t i = 0; i < assignStat->vars.size; ++i)
+		{
+			VISIT_CHILD(assignStat->vars.data[i])
+		}
+		return false;
+	}
+};
+
+class LocalInliner : public LocalRewriter
+{
+	Luau::Parser::AstLocal* find;
+	Luau::Parser::AstExpr* replace;
+
+	Luau::Parser::AstExpr* substitute(Luau::Parser::AstLocal* local) override
+	{
+		return local == find ? replace : nullptr;
+	}
+
+	bool mayReference(const BlockSummary& summary) override
+	{
+		return summary.freeLocals.count(find) != 0;
+	}
+public:
+	LocalInliner(Luau::Parser::AstLocal* find, Luau::Parser::AstExpr* replace)
+		: find(find), replace(replace) {};
+};
+
+using LocalSubstitutions = phmap::flat_hash_map<Luau::Parser::AstLocal*, Luau::Parser::AstExpr*>;
+
+// Applies every pending substitution in a single traversal of a statement.
+class LocalSubstituter : public LocalRewriter
+{
+	const LocalSubstitutions& substitutions;
+
+	Luau::Parser::AstExpr* substitute(Luau::Parser::AstLocal* local) override
+	{
+		auto it = substitutions.find(local);
+		return it != substitutions.cend() ? it->second : nullptr;
+	}
+
+	bool mayReference(const BlockSummary& summary) override
+	{
+		if (substitutions.size() < summary.freeLocals.size())
+		{
+			for (const auto& [local, replace] : substitutions)
+			{
+				if (summary.freeLocals.count(local))
+					return true;
+			}
+			return false;
+		}
+
+		for (const auto& [local, data] : summary.freeLocals)
+		{
+			if (substitutions.count(local))
+				return true;
+		}
+		return false;
+	}
+public:
+	LocalSubstituter(const LocalSubstitutions& substitutions)
+		: substitutions(substitutions) {};
+};
+
+inline unsigned countTrailingZeros(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+	// _BitScanForward64 is only available on 64-bit targets
+	unsigned long index;
+	if (_BitScanForward(&index, uint32_t(value)))
+		return unsigned(index);
+	_BitScanForward(&index, uint32_t(value >> 32));
+	return unsigned(index) + 32;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return unsigned(index);
+#else
+	return unsigned(__builtin_ctzll(value));
+#endif
+}
+
+// Set of registers, one bit per register.
+struct alignas(16) RegisterSet
+{
+	static constexpr size_t kMaxRegisters = 256;
+
+	uint64_t words[kMaxRegisters / 64] = {};
+
+	static RegisterSet all()
+	{
+		RegisterSet s;
+		for (auto& word : s.words)
+			word = ~uint64_t(0);
+		return s;
+	}
+
+	bool test(uint_fast16_t reg) const
+	{
+		return reg < kMaxRegisters && ((words[reg >> 6] >> (reg & 63)) & 1) != 0;
+	}
+
+	void set(uint_fast16_t reg)
+	{
+		if (reg < kMaxRegisters)
+			words[reg >> 6] |= uint64_t(1) << (reg & 63);
+	}
+
+	void reset(uint_fast16_t reg)
+	{
+		if (reg < kMaxRegisters)
+			words[reg >> 6] &= ~(uint64_t(1) << (reg & 63));
+	}
+
+	// sets [first, last)
+	void setRange(uint_fast16_t first, uint_fast16_t last)
+	{
+		for (auto reg = first; reg < last && reg < kMaxRegisters; ++reg)
+			set(reg);
+	}
+
+	void clear()
+	{
+		*this = RegisterSet{};
+	}
+
+	bool any() const
+	{
+		return (words[0] | words[1] | words[2] | words[3]) != 0;
+	}
+
+	// calls f for every register in the set, in ascending order
+	template <typename F>
+	void forEach(F f) const
+	{
+		for (size_t j = 0; j < kMaxRegisters / 64; ++j)
+		{
+			for (auto word = words[j]; word; word &= word - 1)
+				f(uint_fast16_t(j * 64 + countTrailingZeros(word)));
+		}
+	}
+
+#ifdef DECOMPILER_SSE2
+	RegisterSet& operator|=(const RegisterSet& other)
+	{
+		auto dst = reinterpret_cast<__m128i*>(words);
+		auto src = reinterpret_cast<const __m128i*>(other.words);
+		_mm_store_si128(dst, _mm_or_si128(_mm_load_si128(dst), _mm_load_si128(src)));
+		_mm_store_si128(dst + 1, _mm_or_si128(_mm_load_si128(dst + 1), _mm_load_si128(src + 1)));
+		return *this;
+	}
+
+	RegisterSet& operator&=(const RegisterSet& other)
+	{
+		auto dst = reinterpret_cast<__m128i*>(words);
+		auto src = reinterpret_cast<const __m128i*>(other.words);
+		_mm_store_si128(dst, _mm_and_si128(_mm_load_si128(dst), _mm_load_si128(src)));
+		_mm_store_si128(dst + 1, _mm_and_si128(_mm_load_si128(dst + 1), _mm_load_si128(src + 1)));
+		return *this;
+	}
+
+	bool operator==(const RegisterSet& other) const
+	{
+		auto lhs = reinterpret_cast<const __m128i*>(words);
+		auto rhs = reinterpret_cast<const __m128i*>(other.words);
+		auto eq = _mm_and_si128(_mm_cmpeq_epi32(_mm_load_si128(lhs), _mm_load_si128(rhs)),
+			_mm_cmpeq_epi32(_mm_load_si128(lhs + 1), _mm_load_si128(rhs + 1)));
+		return _mm_movemask_epi8(eq) == 0xFFFF;
+	}
+
+	// use | (out & ~def)
+	static RegisterSet transfer(const RegisterSet& use, const RegisterSet& def,
+		const RegisterSet& out)
+	{
+		RegisterSet res;
+		auto u = reinterpret_cast<const __m128i*>(use.words);
+		auto d = reinterpret_cast<const __m128i*>(def.words);
+		auto o = reinterpret_cast<const __m128i*>(out.words);
+		auto r = reinterpret_cast<__m128i*>(res.words);
+		_mm_store_si128(r, _mm_or_si128(_mm_load_si128(u),
+			_mm_andnot_si128(_mm_load_si128(d), _mm_load_si128(o))));
+		_mm_store_si128(r + 1, _mm_or_si128(_mm_load_si128(u + 1),
+			_mm_andnot_si128(_mm_load_si128(d + 1), _mm_load_si128(o + 1))));
+		return res;
+	}
+#else
+	RegisterSet& operator|=(const RegisterSet& other)
+	{
+		for (size_t j = 0; j < kMaxRegisters / 64; ++j)
+			words[j] |= other.words[j];
+		return *this;
+	}
+
+	RegisterSet& operator&=(const RegisterSet& other)
+	{
+		for (size_t j = 0; j < kMaxRegisters / 64; ++j)
+			words[j] &= other.words[j];
+		return *this;
+	}
+
+	bool operator==(const RegisterSet& other) const
+	{
+		return memcmp(words, other.words, sizeof(words)) == 0;
+	}
+
+	static RegisterSet transfer(const RegisterSet& use, const RegisterSet& def,
+		const RegisterSet& out)
+	{
+		RegisterSet res;
+		for (size_t j = 0; j < kMaxRegisters / 64; ++j)
+			res.words[j] = use.words[j] | (out.words[j] & ~def.words[j]);
+		return res;
+	}
+#endif
+
+	bool operator!=(const RegisterSet& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// Register -> local mapping for the proto being decompiled. Registers are
+// bounded by Proto::maxRegCount, so a flat array with an occupancy mask
+// replaces hashing and makes snapshots a plain copy.
+class RegisterFile
+{
+public:
+	static constexpr size_t kMaxRegisters = RegisterSet::kMaxRegisters;
+
+	struct Snapshot
+	{
+		std::array<Luau::Parser::AstLocal*, kMaxRegisters> locals;
+		RegisterSet occupied;
+	};
+
+	Luau::Parser::AstLocal* find(uint_fast16_t reg) const
+	{
+		return occupied.test(reg) ? locals[reg] : nullptr;
+	}
+
+	Luau::Parser::AstLocal* at(uint_fast16_t reg) const
+	{
+		if (!occupied.test(reg))
+			throw std::out_of_range("register " + std::to_string(reg) + " is not bound to a local");
+
+		return locals[reg];
+	}
+
+	// registers are validated against maxRegCount when the proto is loaded
+	Luau::Parser::AstLocal* set(uint_fast16_t reg, Luau::Parser::AstLocal* local)
+	{
+		assert(reg < kMaxRegisters);
+
+		occupied.set(reg);
+		pendingValues.reset(reg);
+		return locals[reg] = local;
+	}
+
+	// fold mode: reg holds an expression, defined by the instruction at pc,
+	// that has not been assigned to a local yet and is handed to its single
+	// reader instead
+	void setPending(uint_fast16_t reg, Luau::Parser::AstExpr* expr, size_t pc)
+	{
+		assert(reg < kMaxRegisters);
+
+		occupied.reset(reg);
+		pendingValues.set(reg);
+		values[reg] = expr;
+		definitions[reg] = pc;
+	}
+
+	Luau::Parser::AstExpr* pendingValue(uint_fast16_t reg) const
+	{
+		return values[reg];
+	}
+
+	// instruction that defined the pending value in reg
+	size_t definition(uint_fast16_t reg) const
+	{
+		return definitions[reg];
+	}
+
+	Luau::Parser::AstExpr* takePending(uint_fast16_t reg)
+	{
+		if (!pendingValues.test(reg))
+			return nullptr;
+
+		pendingValues.reset(reg);
+		return values[reg];
+	}
+
+	const RegisterSet& pending() const
+	{
+		return pendingValues;
+	}
+
+	void erase(uint_fast16_t reg)
+	{
+		occupied.reset(reg);
+	}
+
+	// unbinds every register not in keep
+	void retain(const RegisterSet& keep)
+	{
+		occupied &= keep;
+	}
+
+	void clear()
+	{
+		occupied.clear();
+	}
+
+	Snapshot snapshot() const
+	{
+		return { locals, occupied };
+	}
+
+	void restore(const Snapshot& s)
+	{
+		locals = s.locals;
+		occupied = s.occupied;
+	}
+private:
+	std::array<Luau::Parser::AstLocal*, kMaxRegisters> locals;
+	RegisterSet occupied;
+
+	std::array<Luau::Parser::AstExpr*, kMaxRegisters> values;
+	std::array<size_t, kMaxRegisters> definitions;
+	RegisterSet pendingValues;
+};
+
+// Backward register liveness over a proto's instruction stream. Results are
+// indexed by instruction position; aux words and closure captures belong to
+// the instruction in front of them. Register bindings that must outlive a
+// dead value (loop-carried registers, registers read after an if region and
+// registers captured by a closure) are pinned and never reported dead.
+class RegisterLiveness
+{
+public:
+	void analyze(const Proto* p);
+
+	// false when the proto has control flow the analysis does not model;
+	// callers fall back to keeping every binding
+	bool exact() const
+	{
+		return isExact;
+	}
+
+	// whether the value held in reg does not survive the instruction at pc
+	bool dead(size_t pc, uint_fast16_t reg) const
+	{
+		const auto& info = instructions[pc];
+		return !info.pinned.test(reg)
+			&& (info.def.test(reg) || !info.liveOut.test(reg));
+	}
+
+	// whether the value written to reg at pc has a single reader later in the
+	// same basic block that can take the expression itself
+	bool foldable(size_t pc, uint_fast16_t reg) const
+	{
+		return instructions[pc].folds.test(reg);
+	}
+
+	// whether a value folded at older stays in order with one folded at newer
+	// (defined after it) while both are pending: newer is read first, or
+	// both are read by one instruction that evaluates older first
+	bool foldsInOrder(size_t older, size_t newer) const
+	{
+		const auto& o = instructions[older];
+		const auto& n = instructions[newer];
+		return n.foldReader < o.foldReader
+			|| (n.foldReader == o.foldReader && o.foldRank < n.foldRank);
+	}
+
+	// whether the instruction at pc is the last one of its basic block
+	bool endsBlock(size_t pc) const
+	{
+		return pc + 1 >= instructions.size() || instructions[pc + 1].leader;
+	}
+
+	const RegisterSet& uses(size_t pc) const
+	{
+		return instructions[pc].use;
+	}
+
+	// registers whose bindings are still needed after the instruction at pc
+	RegisterSet retained(size_t pc) const
+	{
+		const auto& info = instructions[pc];
+
+		auto res = info.liveOut;
+		res |= info.pinned;
+		if (pc + 1 < instructions.size())
+			res |= instructions[pc + 1].liveIn;
+		return res;
+	}
+private:
+	struct InstructionInfo
+	{
+		RegisterSet use;
+		RegisterSet def;
+		RegisterSet liveIn;
+		RegisterSet liveOut;
+		RegisterSet pinned;
+		RegisterSet folds;
+
+		// reader of the folded value, and where the reader evaluates it
+		// among its operands
+		size_t foldReader = 0;
+		byte foldRank = 0;
+
+		size_t successors[2] = {};
+		byte successorCount = 0;
+		bool leader = false;
+	};
+
+	struct Region
+	{
+		size_t start;
+		size_t end;
+		RegisterSet pinned;
+	};
+
+	void addSuccessor(InstructionInfo& info, size_t target)
+	{
+		if (target == DecodedCode::kNoTarget)
+		{
+			isExact = false;
+			return;
+		}
+
+		if (target < instructions.size())
+			info.successors[info.successorCount++] = target;
+	}
+
+	const RegisterSet& liveInAt(size_t pc) const
+	{
+		static const RegisterSet none{};
+		return pc < instructions.size() ? instructions[pc].liveIn : none;
+	}
+
+	void solve();
+	void pin(const DecodedCode& code);
+	void fold(const DecodedCode& code);
+
+	std::vector<InstructionInfo> instructions;
+	bool isExact = true;
+};
+
+void RegisterLiveness::analyze(const Proto* p)
+{
+	const auto& code = p->decoded;
+	auto n = code.size();
+
+	instructions.assign(n, {});
+	isExact = !code.malformed();
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const auto& instr = code[i];
+		auto& info = instructions[i];
+
+		bool fallthrough = true;
+
+		switch (instr.op)
+		{
+		case OpCode::Nop:
+		case OpCode::SaveCode:
+		case OpCode::SaveRegisters:
+		case OpCode::ClearStack:
+		case OpCode::ClearStackFull:
+			break;
+		case OpCode::LoadBool:
+			info.def.set(instr.a);
+			if (instr.c)
+				addSuccessor(info, instr.target);
+			break;
+		case OpCode::LoadNil:
+		case OpCode::LoadShort:
+		case OpCode::LoadConst:
+		case OpCode::GetUpvalue:
+		case OpCode::NewTableConst:
+		case OpCode::LoadConstLarge:
+			info.def.set(instr.a);
+			break;
+		case OpCode::GetGlobal:
+		case OpCode::GetGlobalConst:
+		case OpCode::NewTable:
+			info.def.set(instr.a);
+			break;
+		case OpCode::SetGlobal:
+			info.use.set(instr.a);
+			break;
+		case OpCode::SetUpvalue:
+			info.use.set(instr.a);
+			break;
+		case OpCode::Move:
+		case OpCode::GetTableIndexByte:
+		case OpCode::Not:
+		case OpCode::UnaryMinus:
+		case OpCode::Len:
+		case OpCode::AddByte:
+		case OpCode::SubByte:
+		case OpCode::MulByte:
+		case OpCode::DivByte:
+		case OpCode::ModByte:
+		case OpCode::PowByte:
+		case OpCode::OrByte:
+		case OpCode::AndByte:
+			info.use.set(instr.b);
+			info.def.set(instr.a);
+			break;
+		case OpCode::GetTableIndex:
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Div:
+		case OpCode::Mod:
+		case OpCode::Pow:
+		case OpCode::Or:
+		case OpCode::And:
+			info.use.set(instr.b);
+			info.use.set(instr.c);
+			info.def.set(instr.a);
+			break;
+		case OpCode::GetTableIndexConstant:
+			info.use.set(instr.b);
+			info.def.set(instr.a);
+			break;
+		case OpCode::SetTableIndex:
+			info.use.set(instr.a);
+			info.use.set(instr.b);
+			info.use.set(instr.c);
+			break;
+		case OpCode::SetTableIndexByte:
+			info.use.set(instr.a);
+			info.use.set(instr.b);
+			break;
+		case OpCode::SetTableIndexConstant:
+			info.use.set(instr.a);
+			info.use.set(instr.b);
+			break;
+		case OpCode::Self:
+			info.use.set(instr.b);
+			info.def.set(instr.a);
+			info.def.set(instr.a + 1);
+			break;
+		case OpCode::Concat:
+			info.use.setRange(instr.b, instr.c + 1);
+			info.def.set(instr.a);
+			break;
+		case OpCode::Closure:
+		{
+			info.def.set(instr.a);
+
+			if (instr.b_x >= p->children.size())
+			{
+				isExact = false;
+				break;
+			}
+
+			auto captures = code.captures(instr);
+			for (byte j = 0; j < p->children[instr.b_x]->upvalCount; ++j)
+			{
+				if (captures[j].op == OpCode::Move)
+					info.use.set(captures[j].b);
+			}
+			break;
+		}
+		case OpCode::Call:
+			// multiple arguments/results run up to the stack top, which is
+			// only known while decompiling
+			if (instr.b)
+				info.use.setRange(instr.a, instr.a + instr.b);
+			else
+				info.use.setRange(instr.a, RegisterSet::kMaxRegisters);
+
+			if (instr.c)
+				info.def.setRange(instr.a, instr.a + instr.c - 1);
+			break;
+		case OpCode::Return:
+			if (instr.b)
+				info.use.setRange(instr.a, instr.a + instr.b - 1);
+			else
+				info.use.setRange(instr.a, RegisterSet::kMaxRegisters);
+
+			fallthrough = false;
+			break;
+		case OpCode::LoadVarargs:
+			if (instr.b)
+				info.def.setRange(instr.a, instr.a + instr.b - 1);
+			break;
+		case OpCode::Jump:
+			if (instr.target <= i)
+			{
+				isExact = false;
+				break;
+			}
+
+			addSuccessor(info, instr.target);
+			fallthrough = false;
+			break;
+		case OpCode::LoopJump:
+			addSuccessor(info, instr.target);
+			fallthrough = false;
+			break;
+		case OpCode::Test:
+		case OpCode::NotTest:
+			info.use.set(instr.a);
+			addSuccessor(info, instr.target);
+			break;
+		case OpCode::Equal:
+		case OpCode::LesserOrEqual:
+		case OpCode::LesserThan:
+		case OpCode::NotEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterOrEqual:
+			info.use.set(instr.a);
+			info.use.set(instr.aux & 0xFF);
+			addSuccessor(info, instr.target);
+			break;
+		case OpCode::SetList:
+			info.use = RegisterSet::all();
+			break;
+		default:
+			// numeric/generic for loops, far jumps and builtin calls
+			info.use = RegisterSet::all();
+			isExact = false;
+			break;
+		}
+
+		if (fallthrough)
+			addSuccessor(info, i + 1);
+	}
+
+	if (!isExact)
+		return;
+
+	// basic block leaders: branch targets and whatever follows a branch
+	if (n != 0)
+		instructions.front().leader = true;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const auto& info = instructions[i];
+
+		bool straight = info.successorCount == 1 && info.successors[0] == i + 1;
+		if (!straight && i + 1 < n)
+			instructions[i + 1].leader = true;
+
+		for (byte j = 0; j < info.successorCount; ++j)
+		{
+			if (info.successors[j] != i + 1)
+				instructions[info.successors[j]].leader = true;
+		}
+	}
+
+	solve();
+	pin(code);
+	fold(code);
+}
+
+void RegisterLiveness::solve()
+{
+	// predecessor lists, CSR layout
+	std::vector<size_t> predOffsets(instructions.size() + 1, 0);
+	for (const auto& info : instructions)
+	{
+		for (byte j = 0; j < info.successorCount; ++j)
+			predOffsets[info.successors[j] + 1]++;
+	}
+
+	for (size_t i = 0; i < instructions.size(); ++i)
+		predOffsets[i + 1] += predOffsets[i];
+
+	std::vector<size_t> preds(predOffsets.back());
+	std::vector<size_t> fill(predOffsets.begin(), predOffsets.end() - 1);
+	for (size_t i = 0; i < instructions.size(); ++i)
+	{
+		const auto& info = instructions[i];
+		for (byte j = 0; j < info.successorCount; ++j)
+			preds[fill[info.successors[j]]++] = i;
+	}
+
+	// worklist seeded so the first sweep runs backwards over the code
+	std::vector<size_t> worklist(instructions.size());
+	for (size_t i = 0; i < worklist.size(); ++i)
+		worklist[i] = i;
+	std::vector<bool> queued(instructions.size(), true);
+
+	while (!worklist.empty())
+	{
+		auto i = worklist.back();
+		worklist.pop_back();
+		queued[i] = false;
+
+		auto& info = instructions[i];
+
+		RegisterSet out{};
+		for (byte j = 0; j < info.successorCount; ++j)
+			out |= instructions[info.successors[j]].liveIn;
+
+		info.liveOut = out;
+
+		auto in = RegisterSet::transfer(info.use, info.def, out);
+		if (in == info.liveIn)
+			continue;
+
+		info.liveIn = in;
+		for (auto j = predOffsets[i]; j < predOffsets[i + 1]; ++j)
+		{
+			auto pred = preds[j];
+			if (!queued[pred])
+			{
+				queued[pred] = true;
+				worklist.push_back(pred);
+			}
+		}
+	}
+}
+
+void RegisterLiveness::pin(const DecodedCode& code)
+{
+	std::vector<Region> regions;
+	for (size_t i = 0; i < instructions.size(); ++i)
+	{
+		const auto& instr = code[i];
+
+		switch (instr.op)
 		{
-			stat->visit(this);
+		case OpCode::Test:
+		case OpCode::NotTest:
+		{
+			// a value assigned inside the region and read after it has to
+			// keep the binding from before the region
+			auto exit = instr.target;
+			if (exit <= i)
+				break;
+
+			regions.push_back({ i, exit - 1, liveInAt(exit) });
+			break;
 		}
+		case OpCode::LoopJump:
+		{
+			// loop-carried registers keep their binding for the whole body
+			auto header = instr.target;
+			if (header > i)
+				break;
 
-		if (node->elsebody)
+			auto pinned = liveInAt(header);
+			pinned |= liveInAt(i + 1);
+			regions.push_back({ header, i, pinned });
+			break;
+		}
+		default:;
+		}
+	}
+
+	std::sort(regions.begin(), regions.end(), [](const Region& lhs, const Region& rhs)
+	{
+		return lhs.start != rhs.start ? lhs.start < rhs.start : lhs.end > rhs.end;
+	});
+
+	// regions that overlap without nesting stay open until the ones above
+	// them close, which only pins more than needed
+	std::vector<Region> open;
+	size_t nextRegion = 0;
+	RegisterSet captured{};
+	for (size_t i = 0; i < instructions.size(); ++i)
+	{
+		while (!open.empty() && open.back().end < i)
+			open.pop_back();
+
+		for (; nextRegion < regions.size() && regions[nextRegion].start <= i; ++nextRegion)
 		{
-			for (auto stat : node->elsebody->as<Luau::Parser::AstStatBlock>()->body)
-			{
-				stat->visit(this);
-			}
+			auto region = regions[nextRegion];
+			if (!open.empty())
+				region.pinned |= open.back().pinned;
+			open.push_back(region);
 		}
 
+		auto& info = instructions[i];
+		info.pinned = captured;
+		if (!open.empty())
+			info.pinned |= open.back().pinned;
+
+		// captured locals are shared with the closure from here on
+		if (code[i].op == OpCode::Closure)
+			captured |= info.use;
+	}
+}
+
+// How many times the decompiler reads reg as an expression operand of instr;
+// 0 when instr is not a reader that can take a folded expression.
+static byte foldedReads(const DecodedInstruction& instr, uint_fast16_t reg)
+{
+	switch (instr.op)
+	{
+	case OpCode::Move:
+	case OpCode::GetTableIndexConstant:
+	case OpCode::GetTableIndexByte:
+	case OpCode::Self:
+	case OpCode::AddByte:
+	case OpCode::SubByte:
+	case OpCode::MulByte:
+	case OpCode::DivByte:
+	case OpCode::ModByte:
+	case OpCode::PowByte:
+	case OpCode::Not:
+	case OpCode::UnaryMinus:
+	case OpCode::Len:
+		return instr.b == reg;
+	case OpCode::GetTableIndex:
+	case OpCode::Add:
+	case OpCode::Sub:
+	case OpCode::Mul:
+	case OpCode::Div:
+	case OpCode::Mod:
+	case OpCode::Pow:
+		return (instr.b == reg) + (instr.c == reg);
+	case OpCode::SetGlobal:
+	case OpCode::SetUpvalue:
+		return instr.a == reg;
+	case OpCode::SetTableIndex:
+		return (instr.a == reg) + (instr.b == reg) + (instr.c == reg);
+	case OpCode::SetTableIndexConstant:
+	case OpCode::SetTableIndexByte:
+		return (instr.a == reg) + (instr.b == reg);
+	case OpCode::Concat:
+		return instr.b <= reg && reg <= instr.c;
+	case OpCode::Call:
+		return instr.b != 0 && instr.a <= reg && reg < instr.a + instr.b;
+	case OpCode::Return:
+		return instr.b != 0 && instr.a <= reg && reg + 1 < instr.a + instr.b;
+	default:
+		return 0;
+	}
+}
+
+// Position of reg among the operands instr reads as expressions, in the
+// order the decompiled statement or expression evaluates them.
+static byte foldedOperandRank(const DecodedInstruction& instr, uint_fast16_t reg)
+{
+	switch (instr.op)
+	{
+	case OpCode::GetTableIndex:
+	case OpCode::Add:
+	case OpCode::Sub:
+	case OpCode::Mul:
+	case OpCode::Div:
+	case OpCode::Mod:
+	case OpCode::Pow:
+	case OpCode::SetTableIndexConstant:
+	case OpCode::SetTableIndexByte:
+		return instr.b == reg ? 0 : 1;
+	case OpCode::SetTableIndex:
+		// t[k] = v: table, key, then value
+		return instr.b == reg ? 0 : instr.c == reg ? 1 : 2;
+	case OpCode::Concat:
+		return byte(reg - instr.b);
+	case OpCode::Call:
+	case OpCode::Return:
+		return byte(reg - instr.a);
+	default:
+		return 0;
+	}
+}
+
+// Whether the handler for instr can leave its result pending.
+static bool foldedWrite(const DecodedInstruction& instr)
+{
+	switch (instr.op)
+	{
+	case OpCode::LoadNil:
+	case OpCode::LoadBool:
+	case OpCode::LoadShort:
+	case OpCode::LoadConst:
+	case OpCode::Move:
+	case OpCode::GetGlobal:
+	case OpCode::GetUpvalue:
+	case OpCode::GetGlobalConst:
+	case OpCode::GetTableIndex:
+	case OpCode::GetTableIndexConstant:
+	case OpCode::GetTableIndexByte:
+	case OpCode::Closure:
+	case OpCode::Add:
+	case OpCode::Sub:
+	case OpCode::Mul:
+	case OpCode::Div:
+	case OpCode::Mod:
+	case OpCode::Pow:
+	case OpCode::AddByte:
+	case OpCode::SubByte:
+	case OpCode::MulByte:
+	case OpCode::DivByte:
+	case OpCode::ModByte:
+	case OpCode::PowByte:
+	case OpCode::Concat:
+	case OpCode::Not:
+	case OpCode::UnaryMinus:
+	case OpCode::Len:
+	case OpCode::NewTable:
+	case OpCode::NewTableConst:
+		return true;
+	case OpCode::Call:
+		return instr.c == 2;
+	default:
 		return false;
 	}
+}
 
-	virtual bool visit(Luau::Parser::AstStatWhile* node)
+void RegisterLiveness::fold(const DecodedCode& code)
+{
+	constexpr size_t none = ~size_t(0);
+
+	// first read of each register after the current instruction, within the
+	// current block
+	std::array<size_t, RegisterSet::kMaxRegisters> nextRead;
+	nextRead.fill(none);
+
+	for (size_t i = instructions.size(); i-- > 0;)
 	{
-		VISIT_CHILD(node->condition);
-		for (auto stat : node->body->as<Luau::Parser::AstStatBlock>()->body)
+		auto& info = instructions[i];
+		const auto& instr = code[i];
+
+		if (endsBlock(i))
+			nextRead.fill(none);
+
+		// a closure capturing its own register is a recursive local function
+		bool writes = foldedWrite(instr)
+			&& !(instr.op == OpCode::Closure && info.use.test(instr.a));
+
+		info.def.forEach([&](uint_fast16_t reg)
 		{
-			stat->visit(this);
+			auto reader = nextRead[reg];
+			if (writes && reader != none && !info.pinned.test(reg)
+				&& foldedReads(code[reader], reg) == 1 && dead(reader, reg))
+			{
+				info.folds.set(reg);
+				info.foldReader = reader;
+				info.foldRank = foldedOperandRank(code[reader], reg);
+			}
+
+			nextRead[reg] = none;
+		});
+
+		info.use.forEach([&](uint_fast16_t reg)
+		{
+			nextRead[reg] = i;
+		});
+	}
+}
+
+// Basic blocks of a proto with their dominator tree and natural loops, built
+// once so control flow can be structured in a single pass over the code.
+class ControlFlowGraph
+{
+public:
+	static constexpr uint32_t kNone = ~uint32_t(0);
+
+	struct Block
+	{
+		size_t start = 0;
+		// index of the block's last instruction
+		size_t last = 0;
+		uint32_t successors[2] = { kNone, kNone };
+		byte successorCount = 0;
+		uint32_t idom = kNone;
+		// reverse postorder index, kNone when unreachable
+		uint32_t order = kNone;
+		// the blocks this one dominates are exactly the reachable ones in
+		// [this, dominatedEnd], which also takes in any unreachable blocks
+		// that follow them; kNone when they are not contiguous or the block
+		// is unreachable
+		uint32_t dominatedEnd = kNone;
+		bool loopHeader = false;
+	};
+
+	struct Loop
+	{
+		// first instruction of the body, as targeted by the LoopJump
+		size_t header;
+		// the LoopJump jumping back to the header
+		size_t latch;
+		// the latch is only reached through a branch leaving the loop right
+		// before it, so the loop is a repeat ... until
+		bool repeat;
+	};
+
+	void build(const Proto* p);
+
+	const std::vector<Block>& blocks() const
+	{
+		return blockList;
+	}
+
+	uint32_t blockAt(size_t pc) const
+	{
+		return blockIndex[pc];
+	}
+
+	// loops sorted by header, outermost first
+	const std::vector<Loop>& loops() const
+	{
+		return loopList;
+	}
+
+	bool dominates(uint32_t dominator, uint32_t block) const
+	{
+		if (blockList[block].order == kNone)
+			return false;
+
+		while (block != dominator
+			&& blockList[block].order > blockList[dominator].order)
+		{
+			block = blockList[block].idom;
 		}
-		return false;
+		return block == dominator;
 	}
 
-	virtual bool visit(Luau::Parser::AstStatRepeat* node)
+	// last instruction of the region guarded by the branch at pc, which
+	// jumps forward to target: the blocks dominated by the one it falls
+	// through to, up to the target. false when they stop short of the
+	// target because code outside the region jumps into it
+	std::pair<size_t, bool> guardedRegion(size_t pc, size_t target) const;
+private:
+	void computeDominators();
+
+	std::vector<Block> blockList;
+	std::vector<uint32_t> blockIndex;
+	std::vector<Loop> loopList;
+};
+
+void ControlFlowGraph::build(const Proto* p)
+{
+	const auto& code = p->decoded;
+	auto n = code.size();
+
+	blockList.clear();
+	loopList.clear();
+	blockIndex.assign(n, kNone);
+
+	// block leaders: the entry, branch targets and whatever follows a branch
+	std::vector<bool> leader(n + 1, false);
+	if (n != 0)
+		leader[0] = true;
+
+	for (size_t i = 0; i < n; ++i)
 	{
-		return false;
+		auto target = code[i].target;
+		if (target != DecodedCode::kNoTarget)
+		{
+			leader[target] = true;
+			leader[i + 1] = true;
+		}
+		else if (code[i].op == OpCode::Return)
+		{
+			leader[i + 1] = true;
+		}
 	}
 
-	virtual bool visit(Luau::Parser::AstStatBreak* node)
+	for (size_t i = 0; i < n; ++i)
 	{
-		return false;
+		if (leader[i])
+		{
+			blockList.push_back({});
+			blockList.back().start = i;
+		}
+
+		blockIndex[i] = uint32_t(blockList.size() - 1);
+		blockList.back().last = i;
 	}
 
-	virtual bool visit(Luau::Parser::AstStatReturn* node)
+	for (auto& block : blockList)
 	{
-		for (size_t i = 0; i < node->list.size; ++i)
+		auto i = block.last;
+		const auto& instr = code[i];
+
+		if (instr.target < n)
+			block.successors[block.successorCount++] = blockIndex[instr.target];
+
+		// these always leave the block; a LoadBool with a skip always jumps
+		bool branches = instr.op == OpCode::Jump || instr.op == OpCode::LoopJump
+			|| instr.op == OpCode::Return || (instr.op == OpCode::LoadBool && instr.c != 0);
+
+		if (!branches && i + 1 < n && instr.target != i + 1)
 		{
-			VISIT_CHILD(node->list.data[i]);
+			block.successors[block.successorCount++] = blockIndex[i + 1];
 		}
-		return false;
 	}
 
-	virtual bool visit(Luau::Parser::AstStatExpr* node)
+	computeDominators();
+
+	// a LoopJump closes a natural loop when its header dominates it; code
+	// after an unconditional loop is unreachable and still gets structured
+	for (uint32_t b = 0; b < blockList.size(); ++b)
 	{
-		VISIT_CHILD(node->expr);
-		return false;
+		auto latch = blockList[b].last;
+		const auto& instr = code[latch];
+		if (instr.op != OpCode::LoopJump || instr.target > latch)
+			continue;
+
+		auto header = blockIndex[instr.target];
+		if (blockList[b].order != kNone && !dominates(header, b))
+			continue;
+
+		// the branch before a repeat's LoopJump immediately dominates it and
+		// leaves the loop when taken
+		bool repeat = false;
+		const auto& block = blockList[b];
+		if (block.start == latch && block.order != kNone && latch > 0)
+		{
+			const auto& branch = code[latch - 1];
+			repeat = blockList[block.idom].last == latch - 1
+				&& (branch.op == OpCode::Test || branch.op == OpCode::NotTest)
+				&& branch.target == latch + 1;
+		}
+
+		blockList[header].loopHeader = true;
+		loopList.push_back({ instr.target, latch, repeat });
 	}
 
-	virtual bool visit(Luau::Parser::AstStatLocal* localStat)
+	std::sort(loopList.begin(), loopList.end(), [](const Loop& lhs, const Loop& rhs)
 	{
-		for (size_t i = 0; i < localStat->values.size; ++i)
+		return lhs.header != rhs.header ? lhs.header < rhs.header : lhs.latch > rhs.latch;
+	});
+}
+
+void ControlFlowGraph::computeDominators()
+{
+	if (blockList.empty())
+		return;
+
+	// reverse postorder from the entry block
+	std::vector<uint32_t> postorder;
+	postorder.reserve(blockList.size());
+
+	std::vector<std::pair<uint32_t, byte>> stack;
+	std::vector<bool> visited(blockList.size(), false);
+	stack.push_back({ 0, 0 });
+	visited[0] = true;
+
+	while (!stack.empty())
+	{
+		auto& [b, next] = stack.back();
+		const auto& block = blockList[b];
+		if (next < block.successorCount)
 		{
-			VISIT_CHILD(localStat->values.data[i]);
+			auto succ = block.successors[next++];
+			if (!visited[succ])
+			{
+				visited[succ] = true;
+				stack.push_back({ succ, 0 });
+			}
+			continue;
 		}
-		return false;
+
+		postorder.push_back(b);
+		stack.pop_back();
 	}
 
-	virtual bool visit(Luau::Parser::AstStatFor* node)
+	std::vector<uint32_t> rpo(postorder.rbegin(), postorder.rend());
+	for (uint32_t j = 0; j < rpo.size(); ++j)
+		blockList[rpo[j]].order = j;
+
+	// predecessor lists, CSR layout
+	std::vector<uint32_t> predOffsets(blockList.size() + 1, 0);
+	for (const auto& block : blockList)
 	{
-		return false;
+		for (byte j = 0; j < block.successorCount; ++j)
+			predOffsets[block.successors[j] + 1]++;
 	}
 
-	virtual bool visit(Luau::Parser::AstStatForIn* node)
+	for (size_t b = 0; b < blockList.size(); ++b)
+		predOffsets[b + 1] += predOffsets[b];
+
+	std::vector<uint32_t> preds(predOffsets.back());
+	std::vector<uint32_t> fill(predOffsets.begin(), predOffsets.end() - 1);
+	for (uint32_t b = 0; b < blockList.size(); ++b)
 	{
-		return false;
+		const auto& block = blockList[b];
+		for (byte j = 0; j < block.successorCount; ++j)
+			preds[fill[block.successors[j]]++] = b;
 	}
 
-	virtual bool visit(Luau::Parser::AstStatAssign* assignStat)
+	auto intersect = [&](uint32_t lhs, uint32_t rhs)
 	{
-		for (size_t i = 0; i < assignStat->values.size; ++i)
+		while (lhs != rhs)
 		{
-			VISIT_CHILD(assignStat->values.data[i])
+			while (blockList[lhs].order > blockList[rhs].order)
+				lhs = blockList[lhs].idom;
+			while (blockList[rhs].order > blockList[lhs].order)
+				rhs = blockList[rhs].idom;
 		}
+		return lhs;
+	};
 
-		for (size_t i = 0; i < assignStat->vars.size; ++i)
+	// Cooper, Harvey and Kennedy's iterative algorithm
+	blockList[rpo.front()].idom = rpo.front();
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (size_t j = 1; j < rpo.size(); ++j)
 		{
-			VISIT_CHILD(assignStat->vars.data[i])
+			auto b = rpo[j];
+
+			auto idom = kNone;
+			for (auto k = predOffsets[b]; k < predOffsets[b + 1]; ++k)
+			{
+				auto pred = preds[k];
+				if (blockList[pred].idom == kNone)
+					continue;
+
+				idom = idom == kNone ? pred : intersect(pred, idom);
+			}
+
+			if (blockList[b].idom != idom)
+			{
+				blockList[b].idom = idom;
+				changed = true;
+			}
 		}
-		return false;
 	}
-};
+
+	// extent of each dominator subtree; children follow their parent in
+	// reverse postorder, so they are folded in before it is read
+	struct Extent
+	{
+		uint32_t first;
+		uint32_t last;
+		uint32_t count;
+	};
+
+	const size_t blockCount = blockList.size();
+
+	std::vector<Extent> extents(blockCount);
+	for (auto b : rpo)
+		extents[b] = { b, b, 1 };
+
+	for (size_t j = rpo.size() - 1; j > 0; --j)
+	{
+		auto b = rpo[j];
+		auto& parent = extents[blockList[b].idom];
+		parent.first = std::min(parent.first, extents[b].first);
+		parent.last = std::max(parent.last, extents[b].last);
+		parent.count += extents[b].count;
+	}
+
+	// unreachable blocks neither break a range nor end it
+	std::vector<uint32_t> reachableBefore(blockCount + 1, 0);
+	for (size_t b = 0; b < blockCount; ++b)
+		reachableBefore[b + 1] = reachableBefore[b] + (blockList[b].order != kNone);
+
+	std::vector<uint32_t> deadEnd(blockCount);
+	for (size_t b = blockCount; b-- > 0;)
+	{
+		bool deadNext = b + 1 < blockCount && blockList[b + 1].order == kNone;
+		deadEnd[b] = deadNext ? deadEnd[b + 1] : uint32_t(b);
+	}
+
+	for (auto b : rpo)
+	{
+		const auto& extent = extents[b];
+		if (extent.first == b
+			&& reachableBefore[extent.last + 1] - reachableBefore[extent.first] == extent.count)
+		{
+			blockList[b].dominatedEnd = deadEnd[extent.last];
+		}
+	}
+}
+
+std::pair<size_t, bool> ControlFlowGraph::guardedRegion(size_t pc, size_t target) const
+{
+	assert(target > pc && target <= blockIndex.size());
+
+	if (target == pc + 1)
+		return { pc, true };
+
+	// code after an unconditional loop has no dominators and is still
+	// structured by its jump targets
+	const auto& entry = blockList[blockIndex[pc + 1]];
+	if (entry.order == kNone)
+		return { target - 1, true };
+
+	if (entry.dominatedEnd == kNone)
+		return { target - 1, false };
+
+	size_t end = blockList[entry.dominatedEnd].last;
+	if (end + 1 < target)
+		return { end, false };
+
+	return { target - 1, true };
+}
 
 class Decompiler
 {
@@ -430,6 +2415,10 @@ class Decompiler
 
 	bool flagged = false;
 
+	// fold single-use values into their reader while decoding instead of
+	// leaving it to optimize()
+	bool foldExpressions;
+
 	std::vector<std::string_view> stringTable;
 	std::vector<Proto*> protos;
 	Proto* mainProto = nullptr;
@@ -483,7 +2472,43 @@ class Decompiler
 
 	std::vector<Proto*> functionStack;
 
-	using LocalStack = std::unordered_map<uint_fast16_t, Luau::Parser::AstLocal*>;
+	BlockSummaryCache blockSummaries;
+
+	// a proto decompiled under one upvalue binding
+	struct DecompiledProto
+	{
+		std::vector<Luau::Parser::AstLocal*> upvalues;
+		Luau::Parser::AstArray<Luau::Parser::AstLocal*> args;
+		Luau::Parser::AstStatBlock* body;
+	};
+
+	phmap::flat_hash_map<const Proto*, std::vector<DecompiledProto>> decompiledProtos;
+
+	// streaming: main block statements are formatted here as soon as they
+	// are final and their memory is reused
+	Luau::OutputBuffer* streamOutput = nullptr;
+	bool streamed = false;
+
+	// statements gathered before a write, so optimize() and the cache resets
+	// are not paid per statement
+	static constexpr size_t kStreamBatch = 64;
+
+	// optimizes and writes out the main block statements decoded so far.
+	// only valid when nothing decoded later can refer to them
+	void streamStatements(std::vector<Luau::Parser::AstStat*>& body, RegisterFile& localStack,
+		const Luau::Parser::Allocator::Checkpoint& checkpoint)
+	{
+		optimize(body);
+		Luau::formatStatements(*streamOutput, body.data(), body.size());
+		body.clear();
+		streamed = true;
+
+		// everything past the checkpoint belongs to the statements just written
+		localStack.clear();
+		blockSummaries.clear();
+		decompiledProtos.clear();
+		a.rewind(checkpoint);
+	}
 
 	uint32_t c = 0;
 
@@ -500,17 +2525,201 @@ class Decompiler
 			nullptr, functionStack.size() };
 	}
 
-	std::pair<Luau::Parser::AstLocal*, bool> findOrCreateLocal(LocalStack& localStack,
-		const Luau::Parser::Location& location, uint_fast16_t i)
-	{
-		Luau::Parser::AstLocal* local;
-		auto it = localStack.find(i);
-		if (it == localStack.cend())
-		{
-			return { localStack[i] = createLocal(location), true };
+	std::pair<Luau::Parser::AstLocal*, bool> findOrCreateLocal(RegisterFile& localStack,
+		const Luau::Parser::Location& location, uint_fast16_t i)
+	{
+		if (auto local = localStack.find(i))
+			return { local, false };
+
+		return { localStack.set(i, createLocal(location)), true };
+	}
+
+	// binds the register written by the instruction at pc; the old local is
+	// reused only when liveness needs its binding to survive
+	std::pair<Luau::Parser::AstLocal*, bool> defineLocal(RegisterFile& localStack,
+		const RegisterLiveness& liveness, const Luau::Parser::Location& location,
+		size_t pc, uint_fast16_t i)
+	{
+		if (liveness.exact() && liveness.dead(pc, i))
+			localStack.erase(i);
+
+		return findOrCreateLocal(localStack, location, i);
+	}
+
+	// unbinds a register consumed by the instruction at pc
+	void releaseLocal(RegisterFile& localStack, const RegisterLiveness& liveness,
+		size_t pc, uint_fast16_t i)
+	{
+		if (!liveness.exact() || liveness.dead(pc, i))
+			localStack.erase(i);
+	}
+
+	// operand expression for a register: its pending value in fold mode,
+	// otherwise a reference to the bound local
+	std::pair<Luau::Parser::AstExpr*, bool> readRegister(RegisterFile& localStack,
+		const Luau::Parser::Location& location, uint_fast16_t i)
+	{
+		if (auto expr = localStack.takePending(i))
+			return { expr, false };
+
+		auto[local, created] = findOrCreateLocal(localStack, location, i);
+		return { new (a) Luau::Parser::AstExprLocal{ location, local, false }, created };
+	}
+
+	// as readRegister, but the register must already hold a value
+	Luau::Parser::AstExpr* takeRegister(RegisterFile& localStack,
+		const Luau::Parser::Location& location, uint_fast16_t i)
+	{
+		if (auto expr = localStack.takePending(i))
+			return expr;
+
+		auto local = localStack.at(i);
+		return new (a) Luau::Parser::AstExprLocal{ location, local,
+			local->functionDepth != functionStack.size() };
+	}
+
+	// values that can be evaluated later without observing or causing
+	// side effects
+	static bool isPureValue(Luau::Parser::AstExpr* expr)
+	{
+		return expr->is<Luau::Parser::AstExprConstantNil>()
+			|| expr->is<Luau::Parser::AstExprConstantBool>()
+			|| expr->is<Luau::Parser::AstExprConstantNumber>()
+			|| expr->is<Luau::Parser::AstExprConstantString>()
+			|| expr->is<Luau::Parser::AstExprVarargs>()
+			|| expr->is<Luau::Parser::AstExprFunction>()
+			|| expr->is<Luau::Parser::AstExprTable>();
+	}
+
+	// whether evaluating expr can change what other expressions evaluate to,
+	// i.e. it makes a call; reads and arithmetic only observe
+	static bool hasSideEffects(Luau::Parser::AstExpr* expr)
+	{
+		struct CallFinder : Luau::Parser::AstVisitor
+		{
+			bool found = false;
+
+			bool visit(Luau::Parser::AstExpr*) override
+			{
+				return !found;
+			}
+
+			bool visit(Luau::Parser::AstExprFunction*) override
+			{
+				return false;
+			}
+
+			bool visit(Luau::Parser::AstExprCall*) override
+			{
+				found = true;
+				return false;
+			}
+		};
+
+		CallFinder finder;
+		expr->visit(&finder);
+		return finder.found;
+	}
+
+	// assigns pending register values to fresh locals, oldest first. values
+	// in keep, pure ones when keepPure is set and ones defined after the
+	// instruction at last stay pending
+	void flushPending(std::vector<Luau::Parser::AstStat*>& body, RegisterFile& localStack,
+		const RegisterSet& keep, bool keepPure, size_t last = ~size_t(0))
+	{
+		if (!localStack.pending().any())
+			return;
+
+		std::array<uint_fast16_t, RegisterSet::kMaxRegisters> regs;
+		size_t count = 0;
+
+		localStack.pending().forEach([&](uint_fast16_t reg)
+		{
+			if (keep.test(reg) || localStack.definition(reg) > last)
+				return;
+
+			if (keepPure && isPureValue(localStack.pendingValue(reg)))
+				return;
+
+			regs[count++] = reg;
+		});
+
+		std::sort(regs.begin(), regs.begin() + count, [&](uint_fast16_t l, uint_fast16_t r)
+		{
+			return localStack.definition(l) < localStack.definition(r);
+		});
+
+		for (size_t j = 0; j < count; ++j)
+		{
+			auto reg = regs[j];
+			auto expr = localStack.takePending(reg);
+
+			auto local = localStack.set(reg, createLocal(expr->location));
+			body.push_back(new (a) Luau::Parser::AstStatLocal{ expr->location,
+				copy(&local, 1), copy(&expr, 1) });
+		}
+	}
+
+	// appends a statement; pending values it did not consume, other than
+	// pure ones, are materialized first. defineValue keeps those older than
+	// anything the statement consumed, so evaluation order is kept
+	void emit(std::vector<Luau::Parser::AstStat*>& body, RegisterFile& localStack,
+		Luau::Parser::AstStat* stat)
+	{
+		flushPending(body, localStack, {}, true);
+		body.push_back(stat);
+	}
+
+	// result of the instruction at pc; in fold mode a value with a single
+	// reader later in the block stays pending instead of becoming a local
+	void defineValue(std::vector<Luau::Parser::AstStat*>& body, RegisterFile& localStack,
+		const RegisterLiveness& liveness, const Luau::Parser::Location& location,
+		size_t pc, uint_fast16_t i, Luau::Parser::AstExpr* expr)
+	{
+		// an unread pending value still has to be evaluated, after the values
+		// with side effects defined before it
+		if (localStack.pending().test(i))
+		{
+			flushPending(body, localStack, {}, true, localStack.definition(i));
+
+			auto keep = RegisterSet::all();
+			keep.reset(i);
+			flushPending(body, localStack, keep, false);
+		}
+
+		if (foldExpressions && liveness.foldable(pc, i))
+		{
+			// an older pending value that would be read after this one is
+			// evaluated now, along with everything defined before it, when
+			// either of the two has side effects; otherwise the statement
+			// reading it would flush this one first
+			if (!isPureValue(expr))
+			{
+				bool effects = hasSideEffects(expr);
+
+				size_t last = ~size_t(0);
+				localStack.pending().forEach([&](uint_fast16_t reg)
+				{
+					auto value = localStack.pendingValue(reg);
+					if (isPureValue(value) || (!effects && !hasSideEffects(value)))
+						return;
+
+					auto older = localStack.definition(reg);
+					if (!liveness.foldsInOrder(older, pc) && (last == ~size_t(0) || older > last))
+						last = older;
+				});
+
+				if (last != ~size_t(0))
+					flushPending(body, localStack, {}, true, last);
+			}
+
+			localStack.setPending(i, expr, pc);
+			return;
 		}
 
-		return { it->second, false };
+		auto[local, created] = defineLocal(localStack, liveness, location, pc, i);
+		emit(body, localStack, generateLocalAssign(location, local, created,
+			copy(&expr, 1)));
 	}
 
 	Luau::Parser::AstStat* generateLocalAssign(
@@ -533,7 +2742,7 @@ class Decompiler
 	struct ControlFlowInfo
 	{
 		size_t codeStartIndex;
-		size_t bodyStartIndex;
+		// last code word inside the region; the LoopJump for loops
 		size_t codeEndIndex;
 
 		Luau::Parser::AstLocal* local;
@@ -541,18 +2750,98 @@ class Decompiler
 		enum class Type
 		{
 			Test,
-			NotTest
+			NotTest,
+			Loop
 		} type;
 
 		Luau::Parser::Location location;
+
+		// registers as they were bound when the region was entered; locals
+		// first assigned inside the region go out of scope with it
+		RegisterFile::Snapshot registers;
+
+		// statements decompiled inside the region so far
+		std::vector<Luau::Parser::AstStat*> body;
+
+		// loop regions closed by a condition at the bottom
+		bool repeat;
 	};
 
-	Luau::Parser::AstStatBlock* decompile(Proto* p)
+	// condition of the branch opening an if region: what holds when it falls
+	// through into the region, or when it jumps over it if taken is set
+	Luau::Parser::AstExpr* branchCondition(const ControlFlowInfo& cfInfo, bool taken)
+	{
+		Luau::Parser::AstExpr* condExpr = new (a) Luau::Parser::AstExprLocal{ cfInfo.location, cfInfo.local,
+			false };
+
+		// Test jumps when its register is truthy, NotTest when it is not
+		if ((cfInfo.type == ControlFlowInfo::Type::Test) != taken)
+		{
+			condExpr = new (a) Luau::Parser::AstExprUnary{ cfInfo.location, Luau::Parser::AstExprUnary::Op::Not,
+				condExpr };
+		}
+
+		return condExpr;
+	}
+
+	// Wraps the innermost open if region into its AstStatIf.
+	void closeRegion(std::deque<ControlFlowInfo>& f, std::vector<Luau::Parser::AstStat*>& rootBody,
+		RegisterFile& localStack)
+	{
+		auto& cfInfo = f.back();
+		auto location = cfInfo.location;
+
+		optimize(cfInfo.body);
+
+		auto bodyArray = copy<Luau::Parser::AstStat*>(cfInfo.body);
+		auto bodyStat = new (a) Luau::Parser::AstStatBlock{ location, bodyArray };
+
+		auto condExpr = branchCondition(cfInfo, false);
+
+		auto stat = new (a) Luau::Parser::AstStatIf{ location, condExpr, bodyStat,
+			nullptr };
+
+		localStack.restore(cfInfo.registers);
+		f.pop_back();
+
+		(f.empty() ? rootBody : f.back().body).push_back(stat);
+	}
+
+	// Closures over the same proto capturing the same locals decompile to the
+	// same function, so each binding is decompiled once per script and the
+	// resulting body is shared by every site.
+	const DecompiledProto& decompileClosure(Proto* p, std::vector<Luau::Parser::AstLocal*> upvalues)
+	{
+		auto it = decompiledProtos.find(p);
+		if (it != decompiledProtos.end())
+		{
+			for (const auto& decompiled : it->second)
+			{
+				if (decompiled.upvalues == upvalues)
+					return decompiled;
+			}
+		}
+
+		auto decompiled = decompile(p, std::move(upvalues));
+
+		auto& entries = decompiledProtos[p];
+		entries.push_back(std::move(decompiled));
+		return entries.back();
+	}
+
+	DecompiledProto decompile(Proto* p, std::vector<Luau::Parser::AstLocal*> upvalues)
 	{
 		// TempVector<Luau::Parser::AstStat*> body{ scratchStat };
-		std::vector<Luau::Parser::AstStat*> body{};
-		LocalStack localStack{};
+		std::vector<Luau::Parser::AstStat*> rootBody{};
+		RegisterFile localStack{};
 
+		RegisterLiveness liveness{};
+		liveness.analyze(p);
+
+		ControlFlowGraph cfg{};
+		cfg.build(p);
+
+		TempVector<Luau::Parser::AstLocal*> args{ scratchLocal };
 		for (byte i = 0; i < p->argCount; ++i)
 		{
 			std::string nameString = "a";
@@ -566,34 +2855,59 @@ class Decompiler
 				{{0, 0}, {0, 0}}, nullptr,
 				functionStack.size() };
 
-			localStack[i] = local;
-			p->args.push_back(local);
+			localStack.set(i, local);
+			args.push_back(local);
 		}
 
+		auto argArray = copy(args);
+
+		// main block memory from here on is released as statements are streamed
+		auto checkpoint = a.checkpoint();
+
 		bool isTail = false;
 		byte tailBase = 0;
 		Luau::Parser::AstExpr* tailExpr = nullptr;
 
-		bool callRes = false;
-		byte callResBase = 0;
-		byte callResCount = 0;
-
 		bool self = false;
 		Luau::Parser::AstExpr* selfExpr = nullptr;
 
+		// open regions, innermost last; statements go to the innermost one
 		std::deque<ControlFlowInfo> f;
 
-		std::vector<size_t> instrBodyMap{};
-		instrBodyMap.reserve(p->code.size());
+		const auto& loops = cfg.loops();
+		size_t nextLoop = 0;
+
+		const auto& code = p->decoded;
 
-		for (size_t i = 0; i < p->code.size(); ++i)
+		for (size_t pc = 0; pc < code.size(); ++pc)
 		{
-			auto instr = p->code[i];
+			const auto& instr = code[pc];
 
-			auto line = p->lineInfo[i];
+			auto line = p->lineInfo[instr.offset];
 			Luau::Parser::Position position{ line, 0 };
 
-			instrBodyMap.push_back(body.size());
+			for (; nextLoop < loops.size() && loops[nextLoop].header <= pc; ++nextLoop)
+			{
+				const auto& loop = loops[nextLoop];
+
+				// loops that do not nest inside the open regions are left to
+				// their LoopJump
+				if (loop.header != pc
+					|| (!f.empty() && f.back().codeEndIndex < loop.latch))
+				{
+					setFlagged();
+					continue;
+				}
+
+				f.push_back({ pc, loop.latch, nullptr, ControlFlowInfo::Type::Loop,
+					{ position, position }, {}, {}, loop.repeat });
+			}
+
+			auto& body = f.empty() ? rootBody : f.back().body;
+
+			// a block's last instruction cannot leave values pending past it
+			if (foldExpressions && liveness.endsBlock(pc))
+				flushPending(body, localStack, liveness.uses(pc), false);
 
 			switch (instr.op)
 			{
@@ -610,62 +2924,44 @@ class Decompiler
 			case OpCode::LoadNil:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
 				Luau::Parser::AstExpr* nilExpr =
 					new (a) Luau::Parser::AstExprConstantNil{ location };
 
-				auto stat = generateLocalAssign(location, local, created,
-					copy(&nilExpr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, nilExpr);
 				break;
 			}
 			case OpCode::LoadBool:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
 				Luau::Parser::AstExpr* boolExpr =
 					new (a) Luau::Parser::AstExprConstantBool{ location,
 						bool(instr.b) };
 
-				auto stat = generateLocalAssign(location, local, created,
-					copy(&boolExpr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, boolExpr);
 				break;
 			}
 			case OpCode::LoadShort:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
 				Luau::Parser::AstExpr* numExpr =
 					new (a) Luau::Parser::AstExprConstantNumber{ location,
 						double(instr.s_b_x) };
 
-				auto stat = generateLocalAssign(location, local, created,
-					copy(&numExpr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, numExpr);
 				break;
 			}
 			case OpCode::LoadConst:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
 				Luau::Parser::AstExpr* expr =
 					p->constants[instr.b_x]; // TODO: copy and set location
 
-				auto stat = generateLocalAssign(location, local, created,
-					copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 				break;
 			}
 			case OpCode::Move:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[toLocal, toCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
 
 				Luau::Parser::AstExpr* expr;
 				if (isTail && instr.b >= tailBase)
@@ -681,11 +2977,8 @@ class Decompiler
 				}
 				else
 				{
-					auto[fromLocal, fromCreated] =
-						findOrCreateLocal(localStack, location, instr.b);
-
-					expr = new (a) Luau::Parser::AstExprLocal{ location, fromLocal,
-							false };
+					bool fromCreated;
+					std::tie(expr, fromCreated) = readRegister(localStack, location, instr.b);
 
 					if (fromCreated)
 					{
@@ -694,19 +2987,14 @@ class Decompiler
 
 
 				}
-				auto stat = generateLocalAssign(location, toLocal, toCreated,
-					copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 				break;
 			}
 			case OpCode::GetGlobal:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
 
-				i++;
-				uint32_t constantIndex = p->code[i].encoded;
+				uint32_t constantIndex = instr.aux;
 
 				auto globalNameConst =
 					p->constants[constantIndex]->as<Luau::Parser::AstExprConstantString>();
@@ -717,9 +3005,7 @@ class Decompiler
 					new (a) Luau::Parser::AstExprGlobal{ location,
 						Luau::Parser::AstName{ _strdup(globalName.c_str()) } };
 
-				auto stat = generateLocalAssign(location, local, created,
-					copy(&globalExpr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, globalExpr);
 
 				// TODO: verify hash in arg c
 
@@ -728,14 +3014,10 @@ class Decompiler
 			case OpCode::SetGlobal:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
+				auto[valueExpr, valueCreated] =
+					readRegister(localStack, location, instr.a);
 
-				Luau::Parser::AstExpr* valueExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, local, false };
-
-				i++;
-				uint32_t constantIndex = p->code[i].encoded;
+				uint32_t constantIndex = instr.aux;
 				auto globalNameConst =
 					p->constants[constantIndex]->as<Luau::Parser::AstExprConstantString>();
 				std::string globalName{ globalNameConst->value.data,
@@ -747,109 +3029,76 @@ class Decompiler
 
 				auto stat = new (a) Luau::Parser::AstStatAssign{ location,
 					copy(&globalExpr, 1), copy(&valueExpr, 1) };
-				body.push_back(stat);
+				emit(body, localStack, stat);
 				break;
 			}
 			case OpCode::GetUpvalue:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
 
-				auto upLocal = p->upvalues.at(instr.b);
+				auto upLocal = upvalues[instr.b];
 
 				Luau::Parser::AstExpr* expr =
 					new (a) Luau::Parser::AstExprLocal{ location, upLocal, true };
 
-				auto stat =
-					generateLocalAssign(location, resLocal, resCreated, copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 				break;
 			}
 			case OpCode::SetUpvalue:
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[valueLocal, valueCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-				auto upLocal = p->upvalues.at(instr.b);
-
-				Luau::Parser::AstExpr* expr =
-					new (a) Luau::Parser::AstExprLocal{ location, valueLocal, true };
+				auto[expr, valueCreated] =
+					readRegister(localStack, location, instr.a);
+				auto upLocal = upvalues[instr.b];
 
 				auto stat =
 					generateLocalAssign(location, upLocal, false, copy(&expr, 1));
-				body.push_back(stat);
+				emit(body, localStack, stat);
 				break;
 			}
 			case OpCode::SaveRegisters: break;
 			case OpCode::GetGlobalConst:
 			{
 				Luau::Parser::Location location = { position, position };
-				auto[local, created] =
-					findOrCreateLocal(localStack, location, instr.a);
 				Luau::Parser::AstExpr* expr =
 					p->constants[instr.b_x]; // TODO: copy and set location
 
-				auto stat = generateLocalAssign(location, local, created,
-					copy(&expr, 1));
-				body.push_back(stat);
-
-				i++;
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 				break;
 			}
 			case OpCode::GetTableIndex:
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-				auto[tableLocal, tableCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[tableExpr, tableCreated] =
+					readRegister(localStack, location, instr.b);
 
-				auto[indexLocal, indexCreated] =
-					findOrCreateLocal(localStack, location, instr.c);
+				auto[indexExpr, indexCreated] =
+					readRegister(localStack, location, instr.c);
 
 				if (tableCreated || indexCreated)
 					setFlagged();
 
-				auto tableExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					tableLocal, false };
-
-				auto indexExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					indexLocal, false };
-
 				Luau::Parser::AstExpr* expr =
 					new (a) Luau::Parser::AstExprIndexExpr{ location,
 						tableExpr, indexExpr };
 
-				auto stat = generateLocalAssign(location, resLocal, resCreated,
-					copy(&expr, 1));
-
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 				break;
 			}
 			case OpCode::SetTableIndex:
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[valueLocal, valueCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
-				auto[tableLocal, tableCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
-
-				auto[indexLocal, indexCreated] =
-					findOrCreateLocal(localStack, location, instr.c);
-
-				Luau::Parser::AstExpr* valueExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, valueLocal, false };
+				auto[valueExpr, valueCreated] =
+					readRegister(localStack, location, instr.a);
 
-				Luau::Parser::AstExpr* tableExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, tableLocal, false };
+				auto[tableExpr, tableCreated] =
+					readRegister(localStack, location, instr.b);
 
-				auto indexExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					indexLocal, false };
+				auto[indexExpr, indexCreated] =
+					readRegister(localStack, location, instr.c);
 
 				Luau::Parser::AstExpr* expr =
 					new (a) Luau::Parser::AstExprIndexExpr{ location,
@@ -857,7 +3106,7 @@ class Decompiler
 
 				auto stat = new (a) Luau::Parser::AstStatAssign{ location, copy(&expr, 1),
 					copy(&valueExpr, 1) };
-				body.push_back(stat);
+				emit(body, localStack, stat);
 
 				break;
 			}
@@ -865,24 +3114,13 @@ class Decompiler
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-				auto[tableLocal, tableCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[tableExpr, tableCreated] =
+					readRegister(localStack, location, instr.b);
 
 				if (tableCreated)
 					setFlagged();
-				/*
-				if (resCreated && !tableCreated && instr.a + 1 == instr.b)
-				{
-					localStack.erase(instr.b);
-				}*/
 
-				i++;
-				uint32_t constantIndex = p->code[i].encoded;
-
-				auto tableExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					tableLocal, false };
+				uint32_t constantIndex = instr.aux;
 
 				auto indexExpr = p->constants[constantIndex];
 
@@ -890,10 +3128,7 @@ class Decompiler
 					new (a) Luau::Parser::AstExprIndexExpr{ location,
 						tableExpr, indexExpr };
 
-				auto stat = generateLocalAssign(location, resLocal, resCreated,
-					copy(&expr, 1));
-
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 
 				// TODO: verify hash
 				break;
@@ -902,20 +3137,13 @@ class Decompiler
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[valueLocal, valueCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
-				auto[tableLocal, tableCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
-
-				Luau::Parser::AstExpr* valueExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, valueLocal, false };
+				auto[valueExpr, valueCreated] =
+					readRegister(localStack, location, instr.a);
 
-				Luau::Parser::AstExpr* tableExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, tableLocal, false };
+				auto[tableExpr, tableCreated] =
+					readRegister(localStack, location, instr.b);
 
-				i++;
-				uint32_t constantIndex = p->code[i].encoded;
+				uint32_t constantIndex = instr.aux;
 				auto indexExpr = p->constants[constantIndex];
 
 				Luau::Parser::AstExpr* expr =
@@ -924,7 +3152,7 @@ class Decompiler
 
 				auto stat = new (a) Luau::Parser::AstStatAssign{ location, copy(&expr, 1),
 					copy(&valueExpr, 1) };
-				body.push_back(stat);
+				emit(body, localStack, stat);
 
 				break;
 			}
@@ -932,17 +3160,12 @@ class Decompiler
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-				auto[tableLocal, tableCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[tableExpr, tableCreated] =
+					readRegister(localStack, location, instr.b);
 
 				if (tableCreated)
 					setFlagged();
 
-				auto tableExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					tableLocal, false };
-
 				Luau::Parser::AstExpr* indexExpr =
 					new (a) Luau::Parser::AstExprConstantNumber{ location, double(instr.c + 1) };
 
@@ -950,9 +3173,7 @@ class Decompiler
 					new (a) Luau::Parser::AstExprIndexExpr{ location,
 						tableExpr, indexExpr };
 
-				auto stat = generateLocalAssign(location, resLocal, resCreated,
-					copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 
 				break;
 			}
@@ -960,35 +3181,11 @@ class Decompiler
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[valueLocal, valueCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
-				auto[tableLocal, tableCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
-
-				/*
-				if (localStack.find(instr.a + 1) == localStack.cend())
-				{
-					localStack.erase(instr.a);
-					if (instr.b + 1 == instr.c
-						&& instr.c + 1 == instr.a)
-					{
-						localStack.erase(instr.b);
-						localStack.erase(instr.c);
-					}
-				}
-				else if (instr.b + 1 == instr.c
-					&& localStack.find(instr.c + 1) == localStack.cend())
-				{
-					localStack.erase(instr.b);
-					localStack.erase(instr.c);
-				}*/
-
-				Luau::Parser::AstExpr* valueExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, valueLocal, false };
+				auto[valueExpr, valueCreated] =
+					readRegister(localStack, location, instr.a);
 
-				Luau::Parser::AstExpr* tableExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, tableLocal, false };
+				auto[tableExpr, tableCreated] =
+					readRegister(localStack, location, instr.b);
 
 				Luau::Parser::AstExpr* indexExpr =
 					new (a) Luau::Parser::AstExprConstantNumber{ location, double(instr.c + 1) };
@@ -999,25 +3196,37 @@ class Decompiler
 
 				auto stat = new (a) Luau::Parser::AstStatAssign{ location, copy(&expr, 1),
 					copy(&valueExpr, 1) };
-				body.push_back(stat);
+				emit(body, localStack, stat);
 				break;
 			}
 			case OpCode::Closure:
 			{
 				Luau::Parser::Location location = { position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
+				// a folded closure never captures its own register, so it
+				// needs no local until its reader decides
+				bool fold = foldExpressions && liveness.foldable(pc, instr.a);
 
-				auto childProto = p->children.at(instr.b_x);
+				Luau::Parser::AstLocal* resLocal = nullptr;
+				bool resCreated = false;
+				if (!fold)
+				{
+					std::tie(resLocal, resCreated) =
+						defineLocal(localStack, liveness, location, pc, instr.a);
+				}
+
+				auto childProto = p->children[instr.b_x];
 
 				bool useLocalFunction = false;
 
+				// captures are validated to be registers or upvalues
+				std::vector<Luau::Parser::AstLocal*> childUpvalues;
+				childUpvalues.reserve(childProto->upvalCount);
+
+				auto captures = code.captures(instr);
 				for (byte j = 0; j < childProto->upvalCount; ++j)
 				{
-					i++;
-
-					auto upInstr = p->code.at(i);
+					auto upInstr = captures[j];
 					if (upInstr.op == OpCode::Move)
 					{
 						auto[upLocal, upCreated] =
@@ -1028,23 +3237,25 @@ class Decompiler
 						if (upLocal == resLocal)
 							useLocalFunction = true;
 
-						childProto->upvalues.push_back(upLocal);
-					}
-					else if (upInstr.op == OpCode::GetUpvalue)
-					{
-						childProto->upvalues.push_back(p->upvalues.at(upInstr.b));
+						childUpvalues.push_back(upLocal);
 					}
 					else
 					{
-						setFlagged();
+						childUpvalues.push_back(upvalues[upInstr.b]);
 					}
 				}
 
-				auto blockStat = decompile(childProto);
+				const auto& child = decompileClosure(childProto, std::move(childUpvalues));
 				Luau::Parser::AstExpr* funcExpr =
 					new (a) Luau::Parser::AstExprFunction{ location, resLocal,
-						copy(childProto->args), childProto->isVarArg != 0,
-						{}, blockStat };
+						child.args, childProto->isVarArg != 0,
+						{}, child.body };
+
+				if (fold)
+				{
+					defineValue(body, localStack, liveness, location, pc, instr.a, funcExpr);
+					break;
+				}
 
 				Luau::Parser::AstStat* stat;
 				if (useLocalFunction && resCreated)
@@ -1057,7 +3268,7 @@ class Decompiler
 					stat = generateLocalAssign(location, resLocal, resCreated,
 						copy(&funcExpr, 1));
 				}
-				body.push_back(stat);
+				emit(body, localStack, stat);
 
 				break;
 			}
@@ -1066,14 +3277,11 @@ class Decompiler
 				Luau::Parser::Location location = { position, position };
 
 				self = true;
-				i++;
-				uint32_t constantIndex = p->code[i].encoded;
+				uint32_t constantIndex = instr.aux;
 
-				auto[resLocal, resCreated] = findOrCreateLocal(localStack, location, instr.a);
-				auto[tableLocal, tableCreated] = findOrCreateLocal(localStack, location, instr.b);
+				auto[tableExpr, tableCreated] = readRegister(localStack, location, instr.b);
+				auto[resLocal, resCreated] = defineLocal(localStack, liveness, location, pc, instr.a);
 				
-				auto tableExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					tableLocal, false };
 				auto indexExpr = p->constants[constantIndex];
 
 				auto nameString = indexExpr->as<Luau::Parser::AstExprConstantString>()->value;
@@ -1111,33 +3319,26 @@ class Decompiler
 				}
 				else
 				{
-					auto funcLocal = localStack.at(callBaseReg);
-					funcExpr = new (a) Luau::Parser::AstExprLocal{ location,
-						funcLocal,
-						funcLocal->functionDepth != functionStack.size() };
+					funcExpr = takeRegister(localStack, location, callBaseReg);
 				}
 
-				localStack.erase(callBaseReg);
+				releaseLocal(localStack, liveness, pc, callBaseReg);
 
 				TempVector<Luau::Parser::AstExpr*> args{ scratchExpr };
 				if (instr.b)
 				{
 					for (byte j = 1 + self; j < instr.b; j++)
 					{
-						auto local = localStack.at(callBaseReg + j);
-						args.push_back(new (a) Luau::Parser::AstExprLocal{ location,
-							local, local->functionDepth != functionStack.size() });
-						localStack.erase(callBaseReg + j);
+						args.push_back(takeRegister(localStack, location, callBaseReg + j));
+						releaseLocal(localStack, liveness, pc, callBaseReg + j);
 					}
 				}
 				else
 				{
 					for (byte j = callBaseReg + 1 + self; j < tailBase; j++)
 					{
-						auto local = localStack.at(j);
-						args.push_back(new (a) Luau::Parser::AstExprLocal{ location,
-							local, local->functionDepth != functionStack.size() });
-						localStack.erase(j);
+						args.push_back(takeRegister(localStack, location, j));
+						releaseLocal(localStack, liveness, pc, j);
 					}
 
 					args.push_back(tailExpr);
@@ -1149,24 +3350,48 @@ class Decompiler
 
 				if (instr.c)
 				{
-					if (instr.c - 1 != 0)
+					if (instr.c == 2 && foldExpressions && liveness.foldable(pc, callBaseReg))
+					{
+						defineValue(body, localStack, liveness, location, pc, callBaseReg, expr);
+					}
+					else if (instr.c - 1 != 0)
 					{
 						TempVector<Luau::Parser::AstLocal*> locals{ scratchLocal };
+						size_t createdCount = 0;
 						for (byte j = 0; j < instr.c - 1; j++)
 						{
 							auto[local, created] =
-								findOrCreateLocal(localStack, location, callBaseReg + j);
+								defineLocal(localStack, liveness, location, pc, callBaseReg + j);
 							locals.push_back(local);
+							createdCount += created;
+						}
+
+						Luau::Parser::AstStat* stat;
+						if (createdCount == 0)
+						{
+							// results land in locals that stay bound (loop-carried)
+							TempVector<Luau::Parser::AstExpr*> vars{ scratchExpr };
+							for (size_t j = 0; j < locals.size(); ++j)
+								vars.push_back(new (a) Luau::Parser::AstExprLocal{ location,
+									locals[j], false });
+
+							stat = new (a) Luau::Parser::AstStatAssign{ location,
+								copy(vars), copy(&expr, 1) };
 						}
+						else
+						{
+							if (createdCount != locals.size())
+								setFlagged();
 
-						auto stat = new (a) Luau::Parser::AstStatLocal{ location,
-							copy(locals), copy(&expr, 1) };
-						body.push_back(stat);
+							stat = new (a) Luau::Parser::AstStatLocal{ location,
+								copy(locals), copy(&expr, 1) };
+						}
+						emit(body, localStack, stat);
 					}
 					else
 					{
 						auto stat = new (a) Luau::Parser::AstStatExpr{ location, expr };
-						body.push_back(stat);
+						emit(body, localStack, stat);
 					}
 				}
 				else // tail call
@@ -1183,7 +3408,7 @@ class Decompiler
 			case OpCode::Return:
 			{
 				if (instr.b == 1
-					&& (p->isMain || i == p->code.size() - 1))
+					&& (p->isMain || pc + 1 == code.size()))
 				{
 					break;
 				}
@@ -1198,10 +3423,8 @@ class Decompiler
 
 					for (byte j = instr.a; j < tailBase; ++j)
 					{
-						auto local = localStack.at(j);
-						values.push_back(new (a) Luau::Parser::AstExprLocal{ location,
-							local, local->functionDepth != functionStack.size() });
-						localStack.erase(j);
+						values.push_back(takeRegister(localStack, location, j));
+						releaseLocal(localStack, liveness, pc, j);
 					}
 
 					values.push_back(tailExpr);
@@ -1212,17 +3435,15 @@ class Decompiler
 				{
 					for (byte j = 0; j < instr.b - 1; j++)
 					{
-						auto local = localStack.at(instr.a + j);
-						values.push_back(new (a) Luau::Parser::AstExprLocal{ location,
-							local, local->functionDepth != functionStack.size() });
-						localStack.erase(instr.a + j);
+						values.push_back(takeRegister(localStack, location, instr.a + j));
+						releaseLocal(localStack, liveness, pc, instr.a + j);
 					}
 				}
 
 				auto stat = new (a) Luau::Parser::AstStatReturn{ location,
 					copy(values) };
 
-				body.push_back(stat);
+				emit(body, localStack, stat);
 
 				break;
 			}
@@ -1234,48 +3455,77 @@ class Decompiler
 			case OpCode::LoopJump:
 			{
 				// loop jumps always jump backwards (iirc)
-				if (i + instr.s_b_x >= body.size())
+				if (instr.target > pc)
 				{
 					setFlagged();
 					std::cout << "what\n";
 				}
 
-				bool repeat = false;
-
 				Luau::Parser::Location location = { position, position };
 
-				auto bodyStartIndex = instrBodyMap.at(i + instr.s_b_x);
-
 				Luau::Parser::AstExpr* condExpr = new (a) Luau::Parser::AstExprConstantBool{ location, true };
 
-				if (!f.empty()
-					&& i == f.front().codeEndIndex)
+				// an if region ending on the LoopJump is the loop condition. a
+				// repeat leaves the loop when its branch is taken, a while runs
+				// its body when it is not
+				bool conditional = false;
+				bool repeat = false;
+				std::vector<Luau::Parser::AstStat*> innerBody{};
+				if (f.size() >= 2 && f.back().type != ControlFlowInfo::Type::Loop
+					&& f.back().codeEndIndex == pc
+					&& f[f.size() - 2].type == ControlFlowInfo::Type::Loop
+					&& f[f.size() - 2].codeEndIndex == pc)
 				{
-					auto cfInfo = f.front();
-					if (cfInfo.codeStartIndex == i - 1)
-					{
-						repeat = true;
-					}
-
-					condExpr = new (a) Luau::Parser::AstExprLocal{ cfInfo.location, cfInfo.local, false };
-					bodyStartIndex = cfInfo.bodyStartIndex;
-					f.pop_front();
+					auto& cfInfo = f.back();
+
+					conditional = true;
+					repeat = f[f.size() - 2].repeat;
+					condExpr = branchCondition(cfInfo, repeat);
+					innerBody = std::move(cfInfo.body);
+					localStack.restore(cfInfo.registers);
+					f.pop_back();
 				}
 
-				std::vector<Luau::Parser::AstStat*> innerBody{};
-				std::copy(body.begin() + bodyStartIndex, body.end(),
-					std::back_inserter(innerBody));
-
-				body.resize(bodyStartIndex);
+				if (f.empty() || f.back().type != ControlFlowInfo::Type::Loop
+					|| f.back().codeEndIndex != pc)
+				{
+					// not a natural loop nested in the open regions
+					setFlagged();
+				}
+				else
+				{
+					auto loopBody = std::move(f.back().body);
+					f.pop_back();
+
+					// a repeat's condition closes its body; whatever precedes
+					// a while's condition stays in front of the loop
+					auto& parent = f.empty() ? rootBody : f.back().body;
+					if (repeat)
+						loopBody.insert(loopBody.end(), innerBody.begin(), innerBody.end());
+					else if (conditional)
+						parent.insert(parent.end(), loopBody.begin(), loopBody.end());
+
+					if (repeat || !conditional)
+						innerBody = std::move(loopBody);
+				}
 
 				optimize(innerBody);
 
 				auto blockStat = new (a) Luau::Parser::AstStatBlock{ location, copy(innerBody) };
 
-				auto whileStat = new (a) Luau::Parser::AstStatWhile{ location,
-					condExpr, blockStat };
+				Luau::Parser::AstStat* loopStat;
+				if (repeat)
+				{
+					loopStat = new (a) Luau::Parser::AstStatRepeat{ location,
+						condExpr, blockStat };
+				}
+				else
+				{
+					loopStat = new (a) Luau::Parser::AstStatWhile{ location,
+						condExpr, blockStat };
+				}
 
-				body.push_back(whileStat);
+				(f.empty() ? rootBody : f.back().body).push_back(loopStat);
 
 				break;
 			}
@@ -1288,14 +3538,34 @@ class Decompiler
 				if (created)
 					setFlagged();
 
-				if (i + instr.s_b_x <= body.size())
+				if (instr.target <= pc || instr.target > code.size())
 				{
 					setFlagged();
 					std::cout << "what\n";
 				}
 
-				f.push_back({ i, body.size(), i + instr.s_b_x, local,
-					ControlFlowInfo::Type(byte(instr.op) - byte(OpCode::Test)), location });
+				size_t codeEndIndex = pc;
+				if (instr.target > pc)
+				{
+					bool structured;
+					std::tie(codeEndIndex, structured) =
+						cfg.guardedRegion(pc, std::min<size_t>(instr.target, code.size()));
+					if (!structured)
+						setFlagged();
+				}
+
+				// a region reaching past the one it opened in cannot nest
+				if (!f.empty() && codeEndIndex > f.back().codeEndIndex)
+				{
+					setFlagged();
+					codeEndIndex = f.back().codeEndIndex;
+					if (f.back().type == ControlFlowInfo::Type::Loop)
+						codeEndIndex--;
+				}
+
+				f.push_back({ pc, codeEndIndex, local,
+					ControlFlowInfo::Type(byte(instr.op) - byte(OpCode::Test)), location,
+					localStack.snapshot(), {}, false });
 				break;
 			}
 			case OpCode::Equal:
@@ -1304,10 +3574,7 @@ class Decompiler
 			case OpCode::NotEqual:
 			case OpCode::GreaterThan:
 			case OpCode::GreaterOrEqual:
-			{
-				i++;
 				break;
-			}
 			case OpCode::Add:
 			case OpCode::Sub:
 			case OpCode::Mul:
@@ -1317,29 +3584,15 @@ class Decompiler
 			{
 				Luau::Parser::Location location{ position, position };
 
-				auto[leftLocal, leftCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[leftExpr, leftCreated] =
+					readRegister(localStack, location, instr.b);
 				if (leftCreated)
 					setFlagged();
 
-				auto[rightLocal, rightCreated] =
-					findOrCreateLocal(localStack, location, instr.c);
+				auto[rightExpr, rightCreated] =
+					readRegister(localStack, location, instr.c);
 				if (rightCreated)
 					setFlagged();
-				/*
-				if (instr.c == instr.b + 1 && instr.a == instr.b)
-				{
-					localStack.erase(instr.b);
-					localStack.erase(instr.c);
-				}*/
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
-				auto leftExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					leftLocal, false };
-
-				auto rightExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					rightLocal, false };
 
 				auto binaryOp =
 					Luau::Parser::AstExprBinary::Op(byte(instr.op) - byte(OpCode::Add));
@@ -1348,9 +3601,7 @@ class Decompiler
 					new (a) Luau::Parser::AstExprBinary(location, binaryOp,
 						leftExpr, rightExpr);
 
-				auto stat = generateLocalAssign(location, resLocal, resCreated,
-					copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 
 				break;
 			}
@@ -1363,24 +3614,14 @@ class Decompiler
 			{
 				Luau::Parser::Location location{ position, position };
 
-				auto[leftLocal, leftCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[leftExpr, leftCreated] =
+					readRegister(localStack, location, instr.b);
 				if (leftCreated)
 					setFlagged();
 
 				auto rightConstIndex = instr.c;
-				/*
-				if (instr.a == instr.b + 1)
-				{
-					localStack.erase(instr.b);
-				}*/
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
 
-				auto leftExpr = new (a) Luau::Parser::AstExprLocal{ location,
-					leftLocal, false };
-
-				auto rightExpr = p->constants.at(rightConstIndex);
+				auto rightExpr = p->constants[rightConstIndex];
 
 				auto binaryOp =
 					Luau::Parser::AstExprBinary::Op(byte(instr.op) - byte(OpCode::AddByte));
@@ -1389,9 +3630,7 @@ class Decompiler
 					new (a) Luau::Parser::AstExprBinary(location, binaryOp,
 						leftExpr, rightExpr);
 
-				auto stat = generateLocalAssign(location, resLocal, resCreated,
-					copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 
 				break;
 			}
@@ -1411,34 +3650,23 @@ class Decompiler
 			{
 				Luau::Parser::Location location{ position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
-				auto[startLocal, startCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[expr, startCreated] =
+					readRegister(localStack, location, instr.b);
 
 				if (startCreated)
 					setFlagged();
 
-				Luau::Parser::AstExpr* expr =
-					new (a) Luau::Parser::AstExprLocal{ location, startLocal, false };
 				for (byte j = instr.b + 1; j <= instr.c; ++j)
 				{
-					auto[rhsLocal, rhsCreated] = findOrCreateLocal(localStack, location, j);
+					auto[rhsExpr, rhsCreated] = readRegister(localStack, location, j);
 					if (rhsCreated)
 						setFlagged();
 
-					auto rhsExpr =
-						new (a) Luau::Parser::AstExprLocal{ location, rhsLocal, false };
-
 					expr = new (a) Luau::Parser::AstExprBinary{ location,
 						Luau::Parser::AstExprBinary::Concat, expr, rhsExpr };
 				}
 
-				auto stat =
-					generateLocalAssign(location, resLocal, resCreated, copy(&expr, 1));
-
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 
 				break;
 			}
@@ -1448,11 +3676,8 @@ class Decompiler
 			{
 				Luau::Parser::Location location{ position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
-				auto[operandLocal, operandCreated] =
-					findOrCreateLocal(localStack, location, instr.b);
+				auto[operandExpr, operandCreated] =
+					readRegister(localStack, location, instr.b);
 
 				if (operandCreated)
 					setFlagged();
@@ -1460,37 +3685,25 @@ class Decompiler
 				auto unaryOp =
 					Luau::Parser::AstExprUnary::Op(byte(instr.op) - byte(OpCode::Not));
 
-				Luau::Parser::AstExpr* operandExpr =
-					new (a) Luau::Parser::AstExprLocal{ location, operandLocal, false };
-
 				Luau::Parser::AstExpr* expr =
 					new (a) Luau::Parser::AstExprUnary{ location, unaryOp, operandExpr };
 
-				auto stat =
-					generateLocalAssign(location, resLocal, resCreated, copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 
 				break;
 			}
 			case OpCode::NewTable:
-				i++;
 			case OpCode::NewTableConst:
 			{
 				Luau::Parser::Location location{ position, position };
 
-				auto[resLocal, resCreated] =
-					findOrCreateLocal(localStack, location, instr.a);
-
 				Luau::Parser::AstExpr* expr =
 					new (a) Luau::Parser::AstExprTable{ location, {} };
 
-				auto stat =
-					generateLocalAssign(location, resLocal, resCreated, copy(&expr, 1));
-				body.push_back(stat);
+				defineValue(body, localStack, liveness, location, pc, instr.a, expr);
 				break;
 			}
 			case OpCode::SetList:
-				i++;
 				break;
 			case OpCode::ForPrep:
 				std::cout << "unsupported opcode forprep\n"; 
@@ -1533,7 +3746,7 @@ class Decompiler
 				for (size_t j = 0; j < instr.b - 1; ++j)
 				{
 					auto[local, created] =
-						findOrCreateLocal(localStack, location, instr.a + j);
+						defineLocal(localStack, liveness, location, pc, instr.a + j);
 					if (j != 0 && created != last)
 						throw std::runtime_error("unexpected error (ldva).");
 					locals.push_back(local);
@@ -1550,7 +3763,7 @@ class Decompiler
 				{
 					throw std::runtime_error("what the fuck.");
 				}
-				body.push_back(stat);
+				emit(body, localStack, stat);
 				
 				break;
 			}
@@ -1568,56 +3781,61 @@ class Decompiler
 			default:;
 			}
 
-			if (!f.empty()
-				&& i == f.front().codeEndIndex)
-			{
-				auto cfInfo = f.front();
-
-				auto location = cfInfo.location;
-
-				std::vector<Luau::Parser::AstStat*> innerBody{};
-				if (body.begin() + cfInfo.bodyStartIndex <= body.end())
-				{
-					std::copy(body.begin() + cfInfo.bodyStartIndex, body.end(),
-						std::back_inserter(innerBody));
+			// the handler may have opened or closed regions
+			if (foldExpressions && liveness.endsBlock(pc))
+				flushPending(f.empty() ? rootBody : f.back().body, localStack, {}, false);
 
-					body.resize(f.front().bodyStartIndex);
-				}
-				optimize(innerBody);
+			while (!f.empty() && f.back().type != ControlFlowInfo::Type::Loop
+				&& f.back().codeEndIndex <= pc)
+			{
+				closeRegion(f, rootBody, localStack);
+			}
 
-				auto bodyArray = copy<Luau::Parser::AstStat*>(innerBody);
-				auto bodyStat = new (a) Luau::Parser::AstStatBlock{ location, bodyArray };
+			if (liveness.exact())
+				localStack.retain(liveness.retained(pc));
 
-				Luau::Parser::AstExpr* condExpr = new (a) Luau::Parser::AstExprLocal{ location, cfInfo.local,
-					false };
+			// with no open region and nothing carried in registers, later
+			// instructions cannot change the statements decoded so far. an
+			// open multiple-result call is carried in isTail
+			if (streamOutput && p->isMain && f.empty() && rootBody.size() >= kStreamBatch && liveness.exact()
+				&& !liveness.retained(pc).any() && !localStack.pending().any()
+				&& !isTail && !self)
+			{
+				streamStatements(rootBody, localStack, checkpoint);
+			}
+		}
 
-				if (cfInfo.type == ControlFlowInfo::Type::Test)
-				{
-					condExpr = new (a) Luau::Parser::AstExprUnary{ location, Luau::Parser::AstExprUnary::Op::Not,
-						condExpr };
-				}
+		// regions cut short by malformed jumps
+		while (!f.empty())
+		{
+			setFlagged();
+			if (f.back().type != ControlFlowInfo::Type::Loop)
+			{
+				closeRegion(f, rootBody, localStack);
+				continue;
+			}
 
-				auto stat = new (a) Luau::Parser::AstStatIf{ location, condExpr, bodyStat,
-					nullptr };
-				body.push_back(stat);
+			auto loopBody = std::move(f.back().body);
+			f.pop_back();
 
-				f.pop_front();
-			}
+			auto& parent = f.empty() ? rootBody : f.back().body;
+			parent.insert(parent.end(), loopBody.begin(), loopBody.end());
 		}
 
 		Luau::Parser::Position start{ p->lineInfo.front(), 0 };
 		Luau::Parser::Position end{ p->lineInfo.back(), 0 };
 
-		optimize(body);
-		auto bodyArray = copy<Luau::Parser::AstStat*>(body);
+		optimize(rootBody);
+		auto bodyArray = copy<Luau::Parser::AstStat*>(rootBody);
 
 		Luau::Parser::Location location{ start, end };
-		return new (a) Luau::Parser::AstStatBlock{ location, bodyArray };
+		return { std::move(upvalues), argArray,
+			new (a) Luau::Parser::AstStatBlock{ location, bodyArray } };
 	}
 
 	void optimize(/*TempVector*/std::vector<Luau::Parser::AstStat*>& body)
 	{
-		LocalCollector localCollector{};
+		LocalCollector localCollector{ blockSummaries };
 		for (const auto& stat : body)
 		{
 			stat->visit(&localCollector);
@@ -1626,23 +3844,35 @@ class Decompiler
 		auto& localInfo = localCollector.localInfo;
 
 		// split locals
-		std::vector<Luau::Parser::AstStatAssign*> toSplit{};
-		std::vector<LocalInliner> inliners;
+		// every split is recorded in one substitution map keyed by the original
+		// local, so each statement is rewritten in a single traversal.
+		phmap::flat_hash_set<Luau::Parser::AstStatAssign*> toSplit{};
+		LocalSubstitutions substitutions{};
+		LocalSubstituter substituter{ substitutions };
+		substituter.summaries = &blockSummaries;
 		for (auto& stat : body)
 		{
-			for (auto inl : inliners)
+			auto assignStat = stat->as<Luau::Parser::AstStatAssign>();
+
+			// read the target before rewriting, later splits of the same local
+			// must replace the mapping of the original local
+			Luau::Parser::AstLocal* splitLocal = nullptr;
+			if (assignStat && toSplit.count(assignStat))
 			{
-				stat->visit(&inl);
+				splitLocal = assignStat->vars.data[0]->as<Luau::Parser::AstExprLocal>()->local;
 			}
 
-			if (auto assignStat = stat->as<Luau::Parser::AstStatAssign>())
+			if (!substitutions.empty())
 			{
-				auto it = std::find(toSplit.cbegin(), toSplit.cend(), assignStat);
-				if (it != toSplit.cend())
+				stat->visit(&substituter);
+			}
+
+			if (assignStat)
+			{
+				if (splitLocal)
 				{
-					Luau::Parser::AstLocal* local = assignStat->vars.data[0]->as<Luau::Parser::AstExprLocal>()->local;
 					Luau::Parser::AstLocal* newLocal = createLocal(assignStat->location);
-					inliners.emplace_back(local, new (a) Luau::Parser::AstExprLocal{ assignStat->location, newLocal, false });
+					substitutions[splitLocal] = new (a) Luau::Parser::AstExprLocal{ assignStat->location, newLocal, false };
 					stat = new (a) Luau::Parser::AstStatLocal{ assignStat->location,
 						copy(&newLocal, 1), assignStat->values };
 				}
@@ -1659,7 +3889,7 @@ class Decompiler
 			if (it == localInfo.cend())
 				continue;
 
-			auto info = it->second;
+			const auto& info = it->second;
 			if (info.references.size() <= 1)
 				continue;
 
@@ -1681,7 +3911,7 @@ class Decompiler
 #ifdef _DEBUG
 							printf("local '%s' can be split\n", local->name.value);
 #endif
-							toSplit.push_back(assignStatRef);
+							toSplit.insert(assignStatRef);
 							break;
 						}
 					}
@@ -1741,7 +3971,7 @@ class Decompiler
 
 					if (infoIt == localInfo.cend())
 						continue;
-					auto info = infoIt->second;
+					const auto& info = infoIt->second;
 
 					if (info.references.size() == 1)
 					{
@@ -1764,7 +3994,9 @@ class Decompiler
 #endif
 
 						LocalInliner localInliner{ local, localStat->values.data[i] };
+						localInliner.summaries = &blockSummaries;
 						refStat->visit(&localInliner);
+						blockSummaries.invalidate(refStat);
 
 						/*std::string nameString = "var";
 
@@ -1799,18 +4031,64 @@ class Decompiler
 		body.erase(end, body.end());
 		//body.erase(body.begin(), end);
 	}
+	// 1-based, as stored in the bytecode
+	std::string_view stringAt(int index) const
+	{
+		if (index < 1 || size_t(index) > stringTable.size())
+		{
+			throw std::runtime_error("malformed bytecode: string " + std::to_string(index)
+				+ " out of range (" + std::to_string(stringTable.size()) + " strings)");
+		}
+
+		return stringTable[index - 1];
+	}
+
+	// a string constant already read for p, naming part of a global path
+	static Luau::Parser::AstArray<char> constantName(const Proto* p, int index)
+	{
+		if (index < 0 || size_t(index) >= p->constants.size())
+		{
+			throw std::runtime_error("malformed bytecode: global name constant "
+				+ std::to_string(index) + " out of range");
+		}
+
+		auto name = p->constants[index]->as<Luau::Parser::AstExprConstantString>();
+		if (!name)
+		{
+			throw std::runtime_error("malformed bytecode: global name constant "
+				+ std::to_string(index) + " is not a string");
+		}
+
+		return name->value;
+	}
 public:
-	Decompiler(Luau::Parser::Allocator& a/*, Luau::Parser::AstNameTable& names*/)
-		: a(a) /*, names(names)*/ {}
+	Decompiler(Luau::Parser::Allocator& a/*, Luau::Parser::AstNameTable& names*/,
+		bool foldExpressions = false)
+		: a(a) /*, names(names)*/, foldExpressions(foldExpressions) {}
 
 	bool wasFlagged()
 	{
 		return flagged;
 	}
 
+	// format main block statements into out while decompiling; the returned
+	// root then only holds what was not written yet
+	void streamTo(Luau::OutputBuffer* out)
+	{
+		streamOutput = out;
+	}
+
+	bool wasStreamed()
+	{
+		return streamed;
+	}
+
 	Luau::Parser::AstStat* operator()(const std::vector<byte>& bytecode)
 	{
 		flagged = false;
+		streamed = false;
+		blockSummaries.clear();
+		decompiledProtos.clear();
 		generateOpConvTable();
 
 		std::cout << "co1";
@@ -1827,19 +4105,24 @@ public:
 			throw std::runtime_error(
 				std::string{ (const char*)(bytecode.data() + 1), bytecode.size() - 1 });
 		std::cout << "co4";
-		auto stringCount = reader.readInt();
+		auto stringCount = reader.readCount();
 		std::cout << "co5";
 		stringTable.reserve(stringCount);
-		for (int i = 0; i < stringCount; ++i)
+		for (size_t i = 0; i < stringCount; ++i)
 		{
-			auto stringSize = reader.readInt();
+			auto stringSize = reader.readCount();
 			auto string = reader.read<char>(stringSize);
 			stringTable.emplace_back(string, stringSize);
 		}
 
-		auto protoCount = reader.readInt();
+		auto protoCount = reader.readCount();
 		protos.reserve(protoCount);
-		for (int i = 0; i < protoCount; ++i)
+
+		// closure nesting below each proto, bounding decompile() recursion
+		std::vector<size_t> protoDepths;
+		protoDepths.reserve(protoCount);
+
+		for (size_t i = 0; i < protoCount; ++i)
 		{
 			auto p = new (a) Proto{};
 			p->maxRegCount = reader.read<byte>();
@@ -1849,9 +4132,9 @@ public:
 
 			bool studio = false;
 
-			auto instrCount = reader.readInt();
+			auto instrCount = reader.readCount(sizeof(Instruction));
 			p->code.reserve(instrCount);
-			for (auto j = 0; j < instrCount; ++j)
+			for (size_t j = 0; j < instrCount; ++j)
 			{
 				auto instr = reader.read<Instruction>();
 				if (j == 0 && instr.op == OpCode::ClearStackFull)
@@ -1859,36 +4142,29 @@ public:
 					studio = true;
 				}
 				if (!studio)
-					instr.op = opConversionTable.at(byte(instr.op));
+				{
+					auto it = opConversionTable.find(byte(instr.op));
+					if (it == opConversionTable.end())
+					{
+						throw std::runtime_error("malformed bytecode: proto " + std::to_string(i)
+							+ ", offset " + std::to_string(p->code.size()) + ": unknown opcode "
+							+ std::to_string(byte(instr.op)));
+					}
+
+					instr.op = it->second;
+				}
 				p->code.push_back(instr);
 
-				switch (instr.op)
+				if (hasAux(instr.op))
 				{
-				case OpCode::GetGlobal:
-				case OpCode::SetGlobal:
-				case OpCode::GetGlobalConst:
-				case OpCode::GetTableIndexConstant:
-				case OpCode::SetTableIndexConstant:
-				case OpCode::Self:
-				case OpCode::Equal:
-				case OpCode::LesserOrEqual:
-				case OpCode::LesserThan:
-				case OpCode::NotEqual:
-				case OpCode::GreaterThan:
-				case OpCode::GreaterOrEqual:
-				case OpCode::NewTable:
-				case OpCode::SetList:
-				case OpCode::TForLoop:
-				case OpCode::LoadConstLarge:
 					++j;
 					p->code.push_back(reader.read<Instruction>());
-				default:;
 				}
 			}
 
-			auto constCount = reader.readInt();
+			auto constCount = reader.readCount();
 			p->constants.reserve(constCount);
-			for (auto j = 0; j < constCount; ++j)
+			for (size_t j = 0; j < constCount; ++j)
 			{
 				Luau::Parser::Position position{ 0, 0 };
 				Luau::Parser::Location location{ position, position };
@@ -1906,7 +4182,7 @@ public:
 				{
 					setFlagged();
 					expr = new (a) Luau::Parser::AstExprConstantBool{ location,
-						reader.read<bool>() };
+						reader.read<byte>() != 0 };
 					break;
 				}
 				case ConstantType::ConstantNumber:
@@ -1917,7 +4193,7 @@ public:
 				}
 				case ConstantType::ConstantString:
 				{
-					auto strVal = stringTable.at(reader.readInt() - 1);
+					auto strVal = stringAt(reader.readInt());
 					Luau::Parser::AstArray<char> strData{};
 					char* nameData = new (a) char[strVal.length()];
 					memcpy(nameData, strVal.data(), strVal.length());
@@ -1948,7 +4224,7 @@ public:
 					if (v5 > 2)
 						index3 = encodedIndicies & 0x3FF;
 
-					auto nameString1 = p->constants.at(index1)->as<Luau::Parser::AstExprConstantString>()->value;
+					auto nameString1 = constantName(p, index1);
 					char* nameData1 = new (a) char[nameString1.size + 1];
 					memcpy(nameData1, nameString1.data, nameString1.size);
 					nameData1[nameString1.size] = '\0';
@@ -1958,7 +4234,7 @@ public:
 
 					if (index2 >= 0)
 					{
-						auto nameString2 = p->constants.at(index2)->as<Luau::Parser::AstExprConstantString>()->value;
+						auto nameString2 = constantName(p, index2);
 						char* nameData2 = new (a) char[nameString2.size + 1];
 						memcpy(nameData2, nameString2.data, nameString2.size);
 						nameData2[nameString2.size] = '\0';
@@ -1970,7 +4246,7 @@ public:
 
 					if (index3 >= 0)
 					{
-						auto nameString3 = p->constants.at(index3)->as<Luau::Parser::AstExprConstantString>()->value;
+						auto nameString3 = constantName(p, index3);
 						char* nameData3 = new (a) char[nameString3.size + 1];
 						memcpy(nameData3, nameString3.data, nameString3.size);
 						nameData3[nameString3.size] = '\0';
@@ -1984,11 +4260,14 @@ public:
 				case ConstantType::ConstantHashTable:
 				{
 					// throw std::runtime_error("unsupported constant type 'HashTable'");
-					auto hashSize = reader.readInt();
-					for (int j = 0; j < hashSize; ++j)
+					auto hashSize = reader.readCount();
+					for (size_t j = 0; j < hashSize; ++j)
 					{
 						reader.readInt();
 					}
+
+					// the handlers build table literals themselves
+					expr = new (a) Luau::Parser::AstExprTable{ location, {} };
 					break;
 				}
 				default:
@@ -1998,23 +4277,40 @@ public:
 				p->constants.push_back(expr);
 			}
 
-			auto closureCount = reader.readInt();
+			auto closureCount = reader.readCount();
 			p->children.reserve(closureCount);
-			for (auto j = 0; j < closureCount; ++j)
+
+			size_t depth = 0;
+			for (size_t j = 0; j < closureCount; ++j)
 			{
-				p->children.push_back(protos.at(reader.readInt()));
+				auto childIndex = size_t(reader.readInt());
+				if (childIndex >= protos.size())
+				{
+					throw std::runtime_error("malformed bytecode: proto " + std::to_string(i)
+						+ " references child proto " + std::to_string(childIndex)
+						+ " before it is defined");
+				}
+
+				p->children.push_back(protos[childIndex]);
+				depth = std::max(depth, protoDepths[childIndex] + 1);
+			}
+
+			if (depth > kMaxProtoDepth)
+			{
+				throw std::runtime_error("malformed bytecode: proto " + std::to_string(i)
+					+ " nests closures more than " + std::to_string(kMaxProtoDepth) + " deep");
 			}
 
 			auto nameIndex = reader.readInt();
 			if (nameIndex)
 			{
-				p->name = stringTable.at(nameIndex - 1);
+				p->name = stringAt(nameIndex);
 			}
 
-			auto lineInfoCount = reader.readInt();
+			auto lineInfoCount = reader.readCount();
 			p->lineInfo.reserve(lineInfoCount);
 			int lastLine = 0;
-			for (auto j = 0; j < lineInfoCount; ++j)
+			for (size_t j = 0; j < lineInfoCount; ++j)
 			{
 				lastLine += reader.readInt();
 				p->lineInfo.push_back(lastLine);
@@ -2023,42 +4319,132 @@ public:
 			if (lastLine < 0)
 				setFlagged();
 
+			// stripped line info can be shorter than the code; the
+			// remaining instructions keep the last line seen
+			if (p->lineInfo.size() < p->code.size())
+				p->lineInfo.resize(p->code.size(), lastLine);
+
 			if (reader.read<byte>())
 				setFlagged();
 
+			// children are always read before their parent
+			p->decoded.decode(p);
+			validateProto(p, i);
+
 			protos.push_back(p);
+			protoDepths.push_back(depth);
 		}
 
-		mainProto = protos.at(reader.readInt());
+		auto mainIndex = size_t(reader.readInt());
+		if (mainIndex >= protos.size())
+		{
+			throw std::runtime_error("malformed bytecode: main proto " + std::to_string(mainIndex)
+				+ " out of range (" + std::to_string(protos.size()) + " protos)");
+		}
+
+		mainProto = protos[mainIndex];
+		if (mainProto->upvalCount != 0)
+			throw std::runtime_error("malformed bytecode: main proto has upvalues");
+
 		mainProto->isMain = true;
 
-		return decompile(mainProto);
+		return decompile(mainProto, {}).body;
 	}
 };
 
-void Luau::decompile(std::ostream& buff, const std::vector<byte>& bytecode)
+static const char* kFlaggedNotice =
+	"--[[\n"
+	"\tinput function was flagged as potentially incompatible.\n"
+	"\tplease private message a developer for support.\n"
+	"]]\n";
+
+void Luau::decompile(OutputBuffer& buff, const std::vector<byte>& bytecode,
+	bool foldExpressions)
 {
 	try
 	{
 		Parser::Allocator a;
 		// Parser::AstNameTable names{ a };
-		Decompiler decompiler{ a/*, names*/ };
+		Decompiler decompiler{ a/*, names*/, foldExpressions };
 		auto root = decompiler(bytecode);
 
 		if (decompiler.wasFlagged())
 		{
-			buff
-				<<
-				"--[[\n"
-				"\tinput function was flagged as potentially incompatible.\n"
-				"\tplease private message a developer for support.\n"
-				"]]\n";
+			buff << kFlaggedNotice;
+		}
+
+		formatAstParallel(buff, root);
+	}
+	catch (...)
+	{
+		std::rethrow_exception(std::current_exception());
+	}
+}
+
+void Luau::decompileStreaming(OutputBuffer& buff, const std::vector<byte>& bytecode,
+	bool foldExpressions)
+{
+	try
+	{
+		Parser::Allocator a;
+		Decompiler decompiler{ a, foldExpressions };
+		decompiler.streamTo(&buff);
+		auto root = decompiler(bytecode);
+
+		if (!decompiler.wasStreamed())
+		{
+			// nothing was final before the end, same as decompile()
+			if (decompiler.wasFlagged())
+				buff << kFlaggedNotice;
+
+			formatAst(buff, root);
+			return;
 		}
 
-		formatAst(buff, root);
+		const auto& body = root->as<Parser::AstStatBlock>()->body;
+		formatStatements(buff, body.data, body.size);
+
+		// only known once the whole script was read
+		if (decompiler.wasFlagged())
+			buff << kFlaggedNotice;
 	}
 	catch (...)
 	{
 		std::rethrow_exception(std::current_exception());
 	}
 }
+
+std::string Luau::decompileToSnapshot(const std::vector<byte>& bytecode,
+	bool foldExpressions)
+{
+	Parser::Allocator a;
+	Decompiler decompiler{ a, foldExpressions };
+	auto root = decompiler(bytecode);
+
+	return snapshotAst(root, decompiler.wasFlagged());
+}
+
+void Luau::formatDecompiledSnapshot(OutputBuffer& buff, const char* data, size_t size)
+{
+	if (snapshotFlagged(data, size))
+	{
+		buff << kFlaggedNotice;
+	}
+
+	formatSnapshot(buff, data, size);
+}
+
+void Luau::decompile(std::ostream& buff, const std::vector<byte>& bytecode,
+	bool foldExpressions)
+{
+	OutputBuffer out;
+	decompile(out, bytecode, foldExpressions);
+	buff.write(out.data(), out.size());
+}
+
+std::string Luau::decompile(const std::vector<byte>& bytecode, bool foldExpressions)
+{
+	OutputBuffer out;
+	decompile(out, bytecode, foldExpressions);
+	return out.take();
+}
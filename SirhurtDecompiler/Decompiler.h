@@ -1,10 +1,31 @@
 #pragma once
 #include "ByteStream.h"
+#include "OutputBuffer.h"
 
 #include <ostream>
 #include <vector>
 
 namespace Luau
 {
-	void decompile(std::ostream& buff, const std::vector<byte>& bytecode);
+	// foldExpressions: rebuild expressions while decoding instead of emitting
+	// a local per instruction and inlining them afterwards
+	void decompile(OutputBuffer& buff, const std::vector<byte>& bytecode,
+		bool foldExpressions = false);
+	void decompile(std::ostream& buff, const std::vector<byte>& bytecode,
+		bool foldExpressions = false);
+	// writes each statement of the main function to buff as soon as later
+	// code can no longer change it, reusing its memory afterwards. the output
+	// matches decompile() except that the flagged notice comes last when
+	// statements were written before the whole script was read
+	void decompileStreaming(OutputBuffer& buff, const std::vector<byte>& bytecode,
+		bool foldExpressions = false);
+	// decompiles into an AST snapshot (see AstSnapshot.h) that can be kept
+	// and formatted any number of times without decompiling again
+	std::string decompileToSnapshot(const std::vector<byte>& bytecode,
+		bool foldExpressions = false);
+	// formats a snapshot from decompileToSnapshot, as decompile() would
+	void formatDecompiledSnapshot(OutputBuffer& buff, const char* data, size_t size);
+	// returns the formatted output directly instead of going through a stream
+	std::string decompile(const std::vector<byte>& bytecode,
+		bool foldExpressions = false);
 }
@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace Luau
+{
+	// growable byte sink used by the formatter instead of std::ostream. by
+	// default everything is collected and handed back with take(); when
+	// constructed with a file descriptor the buffer is drained to it in
+	// large writes once it grows past flushThreshold
+	class OutputBuffer
+	{
+		static constexpr size_t kIndentWidth = 4;
+		static constexpr size_t kDefaultFlushThreshold = 1 << 16;
+
+		std::string buffer;
+		int fd = -1;
+		size_t flushThreshold = SIZE_MAX;
+
+		static const char* spaces()
+		{
+			static const std::string s(256, ' ');
+			return s.data();
+		}
+
+		void drain()
+		{
+			const char* data = buffer.data();
+			size_t remaining = buffer.size();
+			while (remaining > 0)
+			{
+#ifdef _WIN32
+				int written = _write(fd, data,
+					static_cast<unsigned int>(std::min<size_t>(remaining, INT_MAX)));
+#else
+				ssize_t written = ::write(fd, data, remaining);
+				if (written < 0 && errno == EINTR)
+					continue;
+#endif
+				if (written <= 0)
+					throw std::runtime_error("failed to write output");
+
+				data += written;
+				remaining -= written;
+			}
+			buffer.clear();
+		}
+
+		void checkFlush()
+		{
+			if (buffer.size() >= flushThreshold)
+				drain();
+		}
+	public:
+		OutputBuffer() = default;
+
+		explicit OutputBuffer(int fd, size_t flushThreshold = kDefaultFlushThreshold)
+			: fd(fd), flushThreshold(flushThreshold)
+		{
+			buffer.reserve(flushThreshold + flushThreshold / 2);
+		}
+
+		~OutputBuffer()
+		{
+			if (fd < 0)
+				return;
+
+			try
+			{
+				drain();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		OutputBuffer(const OutputBuffer&) = delete;
+		OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+		void reserve(size_t size)
+		{
+			buffer.reserve(size);
+		}
+
+		void write(const char* data, size_t size)
+		{
+			buffer.append(data, size);
+			checkFlush();
+		}
+
+		void put(char c)
+		{
+			buffer.push_back(c);
+		}
+
+		void writeIndent(uint32_t level)
+		{
+			size_t count = level * kIndentWidth;
+			while (count > 0)
+			{
+				size_t chunk = std::min<size_t>(count, 256);
+				buffer.append(spaces(), chunk);
+				count -= chunk;
+			}
+		}
+
+		OutputBuffer& operator<<(char c)
+		{
+			put(c);
+			return *this;
+		}
+
+		OutputBuffer& operator<<(const char* str)
+		{
+			write(str, strlen(str));
+			return *this;
+		}
+
+		OutputBuffer& operator<<(std::string_view str)
+		{
+			write(str.data(), str.size());
+			return *this;
+		}
+
+		// writes the shortest literal that reads back as the same double.
+		// integral values (LoadShort immediates, table indices) take an
+		// integer path; inf and nan have no literal so they are spelled as
+		// expressions
+		void writeNumber(double value)
+		{
+			constexpr double kMaxExactInteger = 9007199254740992.0; // 2^53
+
+			char buf[32];
+			std::to_chars_result result;
+
+			if (value >= -kMaxExactInteger && value <= kMaxExactInteger
+				&& double(int64_t(value)) == value && !(value == 0 && std::signbit(value)))
+			{
+				result = std::to_chars(buf, buf + sizeof(buf), int64_t(value));
+			}
+			else if (std::isnan(value))
+			{
+				*this << "(0/0)";
+				return;
+			}
+			else if (std::isinf(value))
+			{
+				*this << (value < 0 ? "-math.huge" : "math.huge");
+				return;
+			}
+			else
+			{
+				result = std::to_chars(buf, buf + sizeof(buf), value);
+			}
+
+			write(buf, result.ptr - buf);
+		}
+
+		// writes everything buffered so far to the file descriptor, if any
+		void flush()
+		{
+			if (fd >= 0)
+				drain();
+		}
+
+		size_t size() const
+		{
+			return buffer.size();
+		}
+
+		const char* data() const
+		{
+			return buffer.data();
+		}
+
+		// hands the collected output back without copying it
+		std::string take()
+		{
+			flush();
+
+			std::string result = std::move(buffer);
+			buffer.clear();
+			return result;
+		}
+	};
+}
@@ -3,35 +3,248 @@
 #include <cstddef>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <exception>
 #include <optional>
 #include <map>
+#include <memory>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARSER_SSE2 1
+#include <emmintrin.h>
+#endif
 
 namespace Luau::Parser
 {
+	// Run scanners used by the lexer. Each returns the length of the prefix
+	// of data made of the bytes it accepts; whole 16-byte chunks are tested
+	// at once and only the tail is looked at byte by byte.
+#ifdef PARSER_SSE2
+	static unsigned countTrailingZeros(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, value);
+		return unsigned(index);
+#else
+		return unsigned(__builtin_ctz(value));
+#endif
+	}
+
+	static unsigned highestBit(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse(&index, value);
+		return unsigned(index);
+#else
+		return unsigned(31 - __builtin_clz(value));
+#endif
+	}
+
+	// SWAR count; __popcnt would need a POPCNT check on top of SSE2
+	static unsigned countBits(uint32_t value)
+	{
+		value -= (value >> 1) & 0x55555555;
+		value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+		value = (value + (value >> 4)) & 0x0f0f0f0f;
+		return unsigned((value * 0x01010101) >> 24);
+	}
+
+	static __m128i load(const char* data)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+	}
+
+	static __m128i lanesEqual(__m128i chunk, char ch)
+	{
+		return _mm_cmpeq_epi8(chunk, _mm_set1_epi8(ch));
+	}
+
+	static __m128i spaceMask(__m128i chunk)
+	{
+		return _mm_or_si128(_mm_or_si128(lanesEqual(chunk, ' '), lanesEqual(chunk, '\t')),
+			_mm_or_si128(lanesEqual(chunk, '\r'), lanesEqual(chunk, '\n')));
+	}
+
+	// lanes holding [A-Za-z0-9_]; bytes >= 0x80 compare as negative and fail
+	static __m128i nameMask(__m128i chunk)
+	{
+		__m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+		__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+			_mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+		return _mm_or_si128(_mm_or_si128(alpha, digit), lanesEqual(chunk, '_'));
+	}
+#endif
+
+	static bool isSpaceChar(char ch)
+	{
+		return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+	}
+
+	static bool isNameChar(char ch)
+	{
+		return static_cast<unsigned int>((ch | 0x20) - 'a') < 26 || static_cast<unsigned int>(ch - '0') < 10 || ch == '_';
+	}
+
+	static size_t scanSpace(const char* data, size_t size)
+	{
+		size_t i = 0;
+#ifdef PARSER_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			unsigned mask = ~_mm_movemask_epi8(spaceMask(load(data + i))) & 0xFFFF;
+			if (mask)
+				return i + countTrailingZeros(mask);
+		}
+#endif
+		while (i < size && isSpaceChar(data[i]))
+			i++;
+
+		return i;
+	}
+
+	static size_t scanName(const char* data, size_t size)
+	{
+		size_t i = 0;
+#ifdef PARSER_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			unsigned mask = ~_mm_movemask_epi8(nameMask(load(data + i))) & 0xFFFF;
+			if (mask)
+				return i + countTrailingZeros(mask);
+		}
+#endif
+		while (i < size && isNameChar(data[i]))
+			i++;
+
+		return i;
+	}
+
+	// stops at a or b; comment and long string bodies end at a newline or
+	// bracket, and at a nul like everything else in the lexer
+	static size_t scanUntil(const char* data, size_t size, char a, char b)
+	{
+		size_t i = 0;
+#ifdef PARSER_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i chunk = load(data + i);
+			unsigned mask = _mm_movemask_epi8(_mm_or_si128(lanesEqual(chunk, a), lanesEqual(chunk, b)));
+			if (mask)
+				return i + countTrailingZeros(mask);
+		}
+#endif
+		while (i < size && data[i] != a && data[i] != b)
+			i++;
+
+		return i;
+	}
+
+	// characters a quoted string holds as is
+	static size_t scanQuoted(const char* data, size_t size, char delimiter)
+	{
+		size_t i = 0;
+#ifdef PARSER_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i chunk = load(data + i);
+			__m128i special = _mm_or_si128(
+				_mm_or_si128(lanesEqual(chunk, delimiter), lanesEqual(chunk, '\\')),
+				_mm_or_si128(_mm_or_si128(lanesEqual(chunk, '\r'), lanesEqual(chunk, '\n')),
+					lanesEqual(chunk, 0)));
+			unsigned mask = _mm_movemask_epi8(special);
+			if (mask)
+				return i + countTrailingZeros(mask);
+		}
+#endif
+		for (; i < size; ++i)
+		{
+			char ch = data[i];
+			if (ch == delimiter || ch == '\\' || ch == '\r' || ch == '\n' || ch == 0)
+				break;
+		}
+
+		return i;
+	}
+
+	// number of newlines in data; last is set to the index of the final one
+	static size_t countNewlines(const char* data, size_t size, size_t& last)
+	{
+		size_t count = 0;
+
+		size_t i = 0;
+#ifdef PARSER_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			unsigned mask = _mm_movemask_epi8(lanesEqual(load(data + i), '\n'));
+			if (mask)
+			{
+				count += countBits(mask);
+				last = i + highestBit(mask);
+			}
+		}
+#endif
+		for (; i < size; ++i)
+		{
+			if (data[i] == '\n')
+			{
+				count++;
+				last = i;
+			}
+		}
+
+		return count;
+	}
+
 	class Lexer
 	{
 	public:
-		Lexer(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator)
+		// start: where lexing begins, for reparsing part of a buffer
+		Lexer(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator,
+			unsigned int startOffset = 0, const Position& start = Position(1, 0))
 			: buffer(buffer)
 			, bufferSize(bufferSize)
-			, offset(0)
-			, line(1)
-			, lineOffset(0)
+			, offset(startOffset)
+			, line(start.line)
+			, lineOffset(startOffset - start.column)
 			, lexeme(Location(Position(0, 0), 0), Lexeme::Eof)
 			, names(names)
 			, allocator(allocator)
 		{
 			static_assert(sizeof(kReserved) / sizeof(kReserved[0]) == Lexeme::Reserved_END - Lexeme::Reserved_BEGIN);
 
-			for (int i = Lexeme::Reserved_BEGIN; i < Lexeme::Reserved_END; ++i)
-				names.addStatic(kReserved[i - Lexeme::Reserved_BEGIN], static_cast<Lexeme::Type>(i));
-
 			// read first lexeme
 			next();
 		}
 
+		// replays tokens instead of lexing their source
+		Lexer(const TokenBuffer& tokens, AstNameTable& names, Allocator& allocator)
+			: buffer(tokens.source())
+			, bufferSize(tokens.sourceSize())
+			, offset(0)
+			, line(1)
+			, lineOffset(0)
+			, lexeme(Location(Position(0, 0), 0), Lexeme::Eof)
+			, names(names)
+			, allocator(allocator)
+			, tokens(&tokens)
+		{
+			next();
+		}
+
 		const Lexeme& next()
 		{
+			if (tokens)
+				return replayNext();
+
 			// consume whitespace or comments before the token
 			while (isSpace(peekch()) || (peekch(0) == '-' && peekch(1) == '-'))
 			{
@@ -44,11 +257,11 @@ namespace Luau::Parser
 				}
 				else
 				{
-					while (isSpace(peekch()))
-						consume();
+					consumeRun(scanSpace(buffer + offset, bufferSize - offset));
 				}
 			}
 
+			lexemeOffset = offset;
 			lexeme = readNext();
 
 			return lexeme;
@@ -59,7 +272,46 @@ namespace Luau::Parser
 			return lexeme;
 		}
 
+		// where the current lexeme starts in the buffer
+		unsigned int currentOffset() const
+		{
+			return lexemeOffset;
+		}
+
+		// where lexing resumes after the current lexeme
+		unsigned int endOffset() const
+		{
+			return offset;
+		}
+
+		Position endPosition() const
+		{
+			return position();
+		}
+
 	private:
+		const Lexeme& replayNext()
+		{
+			if (replayIndex == tokens->size())
+			{
+				assert(tokens->error());
+				throw *tokens->error();
+			}
+
+			lexemeOffset = tokens->offset(replayIndex);
+			lexeme = tokens->lexeme(replayIndex);
+
+			offset = tokens->endOffset(replayIndex);
+			line = lexeme.location.end.line;
+			lineOffset = offset - lexeme.location.end.column;
+
+			// Eof repeats like it does when lexing
+			if (lexeme.type != Lexeme::Eof)
+				replayIndex++;
+
+			return lexeme;
+		}
+
 		static bool isNewline(char ch)
 		{
 			return ch == '\n';
@@ -121,6 +373,19 @@ namespace Luau::Parser
 			offset++;
 		}
 
+		// consume() for size characters at once
+		void consumeRun(size_t size)
+		{
+			size_t last = 0;
+			if (size_t lines = countNewlines(buffer + offset, size, last))
+			{
+				line += static_cast<unsigned int>(lines);
+				lineOffset = static_cast<unsigned int>(offset + last + 1);
+			}
+
+			offset += static_cast<unsigned int>(size);
+		}
+
 		void skipCommentBody()
 		{
 			if (peekch() == '[')
@@ -130,8 +395,9 @@ namespace Luau::Parser
 				if (sep >= 0)
 				{
 					Position start = position();
+					std::string_view contents;
 
-					if (!readLongString(scratchData, sep))
+					if (!readLongString(contents, sep))
 						throw ParseError(Location(start, position()), "unfinished long comment near %s", next().toString().c_str());
 
 					return;
@@ -139,8 +405,7 @@ namespace Luau::Parser
 			}
 
 			// fall back to single-line comment
-			while (peekch() != 0 && !isNewline(peekch()))
-				consume();
+			offset += static_cast<unsigned int>(scanUntil(buffer + offset, bufferSize - offset, '\n', 0));
 		}
 
 		// Given a sequence [===[ or ]===], returns:
@@ -166,10 +431,8 @@ namespace Luau::Parser
 			return (start == peekch()) ? count : (-count) - 1;
 		}
 
-		bool readLongString(std::string& data, int sep)
+		bool readLongString(std::string_view& data, int sep)
 		{
-			data.clear();
-
 			// skip (second) [
 			assert(peekch() == '[');
 			consume();
@@ -189,13 +452,13 @@ namespace Luau::Parser
 						assert(peekch() == ']');
 						consume(); // skip (second) ]
 
-						data.assign(buffer + startOffset, buffer + offset - sep - 2);
+						data = std::string_view(buffer + startOffset, offset - sep - 2 - startOffset);
 						return true;
 					}
 				}
 				else
 				{
-					consume();
+					consumeRun(scanUntil(buffer + offset, bufferSize - offset, ']', 0));
 				}
 			}
 
@@ -249,7 +512,9 @@ namespace Luau::Parser
 			}
 		}
 
-		void readString(std::string& data)
+		// returns a view of the source unless escapes had to be decoded into
+		// data
+		std::string_view readString(std::string& data)
 		{
 			Position start = position();
 
@@ -257,7 +522,16 @@ namespace Luau::Parser
 			assert(delimiter == '\'' || delimiter == '"');
 			consume();
 
-			data.clear();
+			unsigned int startOffset = offset;
+			offset += static_cast<unsigned int>(scanQuoted(buffer + offset, bufferSize - offset, delimiter));
+
+			if (peekch() == delimiter)
+			{
+				consume();
+				return std::string_view(buffer + startOffset, offset - 1 - startOffset);
+			}
+
+			data.assign(buffer + startOffset, offset - startOffset);
 
 			while (peekch() != delimiter)
 			{
@@ -274,15 +548,20 @@ namespace Luau::Parser
 					break;
 
 				default:
-					data += peekch();
-					consume();
+				{
+					size_t size = scanQuoted(buffer + offset, bufferSize - offset, delimiter);
+					data.append(buffer + offset, size);
+					offset += static_cast<unsigned int>(size);
+				}
 				}
 			}
 
 			consume();
+
+			return data;
 		}
 
-		void readNumber(std::string& data, unsigned int startOffset)
+		std::string_view readNumber(unsigned int startOffset)
 		{
 			assert(isDigit(peekch()));
 
@@ -302,10 +581,9 @@ namespace Luau::Parser
 					consume();
 			}
 
-			while (isAlpha(peekch()) || isDigit(peekch()) || peekch() == '_')
-				consume();
+			offset += static_cast<unsigned int>(scanName(buffer + offset, bufferSize - offset));
 
-			data.assign(buffer + startOffset, buffer + offset);
+			return std::string_view(buffer + startOffset, offset - startOffset);
 		}
 
 		Lexeme readNext()
@@ -328,10 +606,12 @@ namespace Luau::Parser
 
 				if (sep >= 0)
 				{
-					if (!readLongString(scratchData, sep))
+					std::string_view contents;
+
+					if (!readLongString(contents, sep))
 						throw ParseError(Location(start, position()), "unfinished long string near %s", next().toString().c_str());
 
-					return Lexeme(Location(start, position()), Lexeme::String, &scratchData);
+					return Lexeme(Location(start, position()), Lexeme::String, contents);
 				}
 				else if (sep == -1)
 					return Lexeme(Location(start, 1), '[');
@@ -393,9 +673,11 @@ namespace Luau::Parser
 
 			case '"':
 			case '\'':
-				readString(scratchData);
+			{
+				std::string_view contents = readString(scratchData);
 
-				return Lexeme(Location(start, position()), Lexeme::String, &scratchData);
+				return Lexeme(Location(start, position()), Lexeme::String, contents);
+			}
 
 			case '.':
 				consume();
@@ -417,9 +699,9 @@ namespace Luau::Parser
 				{
 					if (isDigit(peekch()))
 					{
-						readNumber(scratchData, offset - 1);
+						std::string_view number = readNumber(offset - 1);
 
-						return Lexeme(Location(start, position()), Lexeme::Number, &scratchData);
+						return Lexeme(Location(start, position()), Lexeme::Number, number);
 					}
 					else
 						return Lexeme(Location(start, 1), '.');
@@ -428,20 +710,17 @@ namespace Luau::Parser
 			default:
 				if (isDigit(peekch()))
 				{
-					readNumber(scratchData, offset);
+					std::string_view number = readNumber(offset);
 
-					return Lexeme(Location(start, position()), Lexeme::Number, &scratchData);
+					return Lexeme(Location(start, position()), Lexeme::Number, number);
 				}
 				else if (isAlpha(peekch()) || peekch() == '_')
 				{
 					unsigned int startOffset = offset;
 
-					do consume();
-					while (isAlpha(peekch()) || isDigit(peekch()) || peekch() == '_');
-
-					scratchData.assign(buffer + startOffset, buffer + offset);
+					offset += static_cast<unsigned int>(scanName(buffer + offset, bufferSize - offset));
 
-					std::pair<AstName, Lexeme::Type> name = names.getOrAddWithType(scratchData.c_str());
+					std::pair<AstName, Lexeme::Type> name = names.getOrAddWithType(std::string_view(buffer + startOffset, offset - startOffset));
 
 					if (name.second == Lexeme::Name)
 						return Lexeme(Location(start, position()), Lexeme::Name, name.first.value);
@@ -466,6 +745,8 @@ namespace Luau::Parser
 		unsigned int line;
 		unsigned int lineOffset;
 
+		unsigned int lexemeOffset = 0;
+
 		std::string scratchData;
 
 		Lexeme lexeme;
@@ -473,6 +754,9 @@ namespace Luau::Parser
 		AstNameTable& names;
 
 		Allocator& allocator;
+
+		const TokenBuffer* tokens = nullptr;
+		size_t replayIndex = 0;
 	};
 
 	template <typename T> class TempVector
@@ -520,11 +804,89 @@ namespace Luau::Parser
 			storage.push_back(item);
 		}
 
+		void pop_back()
+		{
+			assert(!empty());
+			storage.pop_back();
+		}
+
 	private:
 		std::vector<T>& storage;
 		unsigned int offset;
 	};
 
+	// moves reused statements, and the locals they declare, down by lines
+	class LineShift : public AstVisitor
+	{
+		int lines;
+
+		void shift(Location& location)
+		{
+			location.begin.line += lines;
+			location.end.line += lines;
+		}
+
+		void shift(AstLocal* local)
+		{
+			if (local)
+				shift(local->location);
+		}
+
+		void shift(const AstArray<AstLocal*>& locals)
+		{
+			for (size_t i = 0; i < locals.size; ++i)
+				shift(locals.data[i]);
+		}
+	public:
+		explicit LineShift(int lines)
+			: lines(lines)
+		{
+		}
+
+		bool visit(AstExpr* node) override
+		{
+			shift(node->location);
+			return true;
+		}
+
+		bool visit(AstStat* node) override
+		{
+			shift(node->location);
+			return true;
+		}
+
+		bool visit(AstExprFunction* node) override
+		{
+			shift(node->self);
+			shift(node->args);
+			return visit(static_cast<AstExpr*>(node));
+		}
+
+		bool visit(AstStatLocal* node) override
+		{
+			shift(node->vars);
+			return visit(static_cast<AstStat*>(node));
+		}
+
+		bool visit(AstStatLocalFunction* node) override
+		{
+			shift(node->var);
+			return visit(static_cast<AstStat*>(node));
+		}
+
+		bool visit(AstStatFor* node) override
+		{
+			shift(node->var);
+			return visit(static_cast<AstStat*>(node));
+		}
+
+		bool visit(AstStatForIn* node) override
+		{
+			shift(node->vars);
+			return visit(static_cast<AstStat*>(node));
+		}
+	};
+
 	class Parser
 	{
 	public:
@@ -535,19 +897,161 @@ namespace Luau::Parser
 			return p.parseChunk();
 		}
 
+		static AstStat* parse(const TokenBuffer& tokens, AstNameTable& names, Allocator& allocator)
+		{
+			Parser p(tokens, names, allocator);
+
+			return p.parseChunk();
+		}
+
+		static size_t parseStreaming(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator, AstVisitor& visitor)
+		{
+			Parser p(buffer, bufferSize, names, allocator);
+
+			return p.parseChunkStreaming(visitor);
+		}
+
+		// parses top-level statements from state.statements[first] onwards;
+		// see IncrementalParser
+		static AstStat* parseIncremental(IncrementalParser& state, const char* buffer, size_t bufferSize,
+			size_t first, size_t oldEnd, size_t newEnd)
+		{
+			using Statement = IncrementalParser::Statement;
+
+			const std::vector<Statement>& old = state.statements;
+
+			unsigned int startOffset = first == 0 ? 0 : old[first].offset;
+			Position start = first == 0 ? Position(1, 0) : old[first].position;
+
+			Parser p(buffer, bufferSize, state.names, state.allocator, startOffset, start);
+
+			// the scope reparsed statements start in
+			size_t localsBefore = first == 0 ? 0 : old[first - 1].locals;
+			for (size_t i = 0; i < localsBefore; ++i)
+			{
+				AstLocal* local = state.locals[i];
+
+				p.localMap[local->name.value] = local;
+				p.localStack.push_back(local);
+			}
+
+			p.incremental = &state;
+			p.reusedLocals = localsBefore;
+
+			// statements after the edit can only be reused from a boundary on a
+			// later line than the edit, so that only their lines move
+			unsigned int editEndLine = start.line;
+			for (size_t i = startOffset; i < newEnd && i < bufferSize; ++i)
+				editEndLine += buffer[i] == '\n';
+
+			ptrdiff_t delta = ptrdiff_t(newEnd) - ptrdiff_t(oldEnd);
+
+			std::vector<Statement> parsed;
+			size_t resume = old.size();
+			int lineDelta = 0;
+
+			for (size_t candidate = first; !p.blockFollow(p.lexer.current()); )
+			{
+				unsigned int offset = p.lexer.currentOffset();
+				Position position = p.lexer.current().location.begin;
+
+				// the previous statement that would start here if the text from
+				// here on is unchanged
+				while (candidate < old.size() && (old[candidate].offset < oldEnd || ptrdiff_t(old[candidate].offset) + delta < ptrdiff_t(offset)))
+					candidate++;
+
+				if (candidate < old.size() && ptrdiff_t(old[candidate].offset) + delta == ptrdiff_t(offset)
+					&& position.line > editEndLine && !p.localsDiverged
+					&& p.reusedLocals == (candidate == 0 ? 0 : old[candidate - 1].locals))
+				{
+					resume = candidate;
+					lineDelta = int(position.line) - int(old[candidate].position.line);
+					break;
+				}
+
+				std::pair<AstStat*, bool> stat = p.parseStat();
+
+				if (p.lexer.current().type == ';')
+					p.lexer.next();
+
+				parsed.push_back({ stat.first, offset, position, localsBefore + p.topLevelLocals.size() });
+
+				if (stat.second)
+					break;
+			}
+
+			if (resume == old.size())
+				p.expect(Lexeme::Eof);
+
+			// nothing below throws, so the previous state survives a parse error
+			std::vector<Statement> statements(old.begin(), old.begin() + first);
+			statements.insert(statements.end(), parsed.begin(), parsed.end());
+
+			std::vector<AstLocal*> locals(state.locals.begin(), state.locals.begin() + localsBefore);
+			locals.insert(locals.end(), p.topLevelLocals.begin(), p.topLevelLocals.end());
+
+			if (resume < old.size())
+				locals.insert(locals.end(), state.locals.begin() + (resume == 0 ? 0 : old[resume - 1].locals), state.locals.end());
+
+			for (const auto& moved : p.movedLocals)
+				moved.first->location = moved.second;
+
+			LineShift shift{ lineDelta };
+
+			for (size_t i = resume; i < old.size(); ++i)
+			{
+				Statement statement = old[i];
+				statement.offset = unsigned(ptrdiff_t(statement.offset) + delta);
+				statement.position.line += lineDelta;
+
+				if (lineDelta != 0)
+					statement.stat->visit(&shift);
+
+				statements.push_back(statement);
+			}
+
+			state.statements = std::move(statements);
+			state.locals = std::move(locals);
+			state.reparsed = parsed.size();
+
+			TempVector<AstStat*> body(p.scratchStat);
+			for (const auto& statement : state.statements)
+				body.push_back(statement.stat);
+
+			Location location =
+				body.empty()
+				? p.lexer.current().location
+				: Location(body.front()->location, body.back()->location);
+
+			return new (state.allocator) AstStatBlock(location, p.copy(body));
+		}
+
 	private:
 		struct Name;
 
-		Parser(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator)
-			: lexer(buffer, bufferSize, names, allocator)
+		Parser(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator,
+			unsigned int startOffset = 0, const Position& start = Position(1, 0))
+			: lexer(buffer, bufferSize, names, allocator, startOffset, start)
+			, allocator(allocator)
+		{
+			enterMain(names);
+		}
+
+		Parser(const TokenBuffer& tokens, AstNameTable& names, Allocator& allocator)
+			: lexer(tokens, names, allocator)
 			, allocator(allocator)
+		{
+			enterMain(names);
+		}
+
+		void enterMain(AstNameTable& names)
 		{
 			Function top;
 			top.vararg = true;
 
 			functionStack.push_back(top);
 
-			nameSelf = names.addStatic("self");
+			nameSelf = names.getOrAdd("self");
 		}
 
 		bool blockFollow(const Lexeme& l)
@@ -569,22 +1073,58 @@ namespace Luau::Parser
 			return result;
 		}
 
-		// chunk ::= {stat [`;']} [laststat [`;']]
-		// block ::= chunk
-		AstStat* parseBlock()
+		// parseChunk() without building the main block: each statement is
+		// visited as soon as it is parsed and the arena is rewound after it
+		size_t parseChunkStreaming(AstVisitor& visitor)
 		{
-			unsigned int localsBegin = saveLocals();
-
-			AstStat* result = parseBlockNoScope();
+			// top-level locals stay visible to the statements after the one
+			// that declares them, so they can't live in the rewound arena
+			Allocator topLevel;
+			topLevelAllocator = &topLevel;
 
-			restoreLocals(localsBegin);
-
-			return result;
-		}
-
-		AstStat* parseBlockNoScope()
-		{
-			TempVector<AstStat*> body(scratchStat);
+			size_t count = 0;
+
+			while (!blockFollow(lexer.current()))
+			{
+				Allocator::Checkpoint checkpoint = allocator.checkpoint();
+
+				std::pair<AstStat*, bool> stat = parseStat();
+
+				if (lexer.current().type == ';')
+					lexer.next();
+
+				stat.first->visit(&visitor);
+				count++;
+
+				allocator.rewind(checkpoint);
+
+				if (stat.second)
+					break;
+			}
+
+			expect(Lexeme::Eof);
+
+			topLevelAllocator = nullptr;
+
+			return count;
+		}
+
+		// chunk ::= {stat [`;']} [laststat [`;']]
+		// block ::= chunk
+		AstStat* parseBlock()
+		{
+			unsigned int localsBegin = saveLocals();
+
+			AstStat* result = parseBlockNoScope();
+
+			restoreLocals(localsBegin);
+
+			return result;
+		}
+
+		AstStat* parseBlockNoScope()
+		{
+			TempVector<AstStat*> body(scratchStat);
 
 			while (!blockFollow(lexer.current()))
 			{
@@ -1230,8 +1770,24 @@ namespace Luau::Parser
 			unsigned char left, right;
 		};
 
+		// an operator whose right operand parseSubExpr is still reading
+		struct PendingOp
+		{
+			Location start;
+			// the limit of the subexpr the operator belongs to
+			unsigned int limit;
+			std::optional<AstExprUnary::Op> unary;
+			AstExprBinary::Op binary;
+			AstExpr* left;
+		};
+
 		// subexpr -> (simpleexp | unop subexpr) { binop subexpr }
 		// where `binop' is any binary operator with a priority higher than `limit'
+		//
+		// operands of right associative and unary operators are subexprs of
+		// their own, so long `..' and `^' chains nest as deep as they are
+		// long; instead of recursing, each operator waiting for its right
+		// operand is kept on an explicit stack
 		std::pair<AstExpr*, std::optional<AstExprBinary::Op> > parseSubExpr(unsigned int limit)
 		{
 			static const BinaryOpPriority binaryPriority[] =
@@ -1245,46 +1801,61 @@ namespace Luau::Parser
 
 			const unsigned int unaryPriority = 8;
 
-			Location start = lexer.current().location;
+			TempVector<PendingOp> pending(scratchPendingOp);
 
-			AstExpr* expr;
-
-			if (std::optional<AstExprUnary::Op> uop = parseUnaryOp(lexer.current()))
+			for (;;)
 			{
-				lexer.next();
+				Location start = lexer.current().location;
 
-				AstExpr* subexpr = parseSubExpr(unaryPriority).first;
-				AstExprConstantNumber* numExpr = subexpr->as<AstExprConstantNumber>();
-				if (uop == AstExprUnary::Op::Minus && numExpr)
+				if (std::optional<AstExprUnary::Op> uop = parseUnaryOp(lexer.current()))
 				{
-					numExpr->value = -numExpr->value;
-					expr = numExpr;
+					lexer.next();
+
+					pending.push_back({ start, limit, uop, AstExprBinary::Op(), nullptr });
+					limit = unaryPriority;
+					continue;
 				}
-				else
+
+				AstExpr* expr = parseSimpleExpr();
+
+				// expand while operators have priorities higher than `limit'
+				std::optional<AstExprBinary::Op> op = parseBinaryOp(lexer.current());
+
+				for (;;)
 				{
-					expr = new (allocator) AstExprUnary(Location(start, subexpr->location), uop.value(), subexpr);
-				}
-			}
-			else
-			{
-				expr = parseSimpleExpr();
-			}
+					if (op && binaryPriority[op.value()].left > limit)
+						break;
 
-			// expand while operators have priorities higher than `limit'
-			std::optional<AstExprBinary::Op> op = parseBinaryOp(lexer.current());
+					// expr is complete; hand it to the operator waiting for it
+					if (pending.empty())
+						return std::make_pair(expr, op);  // return first untreated operator
+
+					PendingOp top = pending.back();
+					pending.pop_back();
+
+					if (top.unary)
+					{
+						AstExprConstantNumber* numExpr = expr->as<AstExprConstantNumber>();
+						if (top.unary == AstExprUnary::Op::Minus && numExpr)
+							numExpr->value = -numExpr->value;
+						else
+							expr = new (allocator) AstExprUnary(Location(top.start, expr->location), top.unary.value(), expr);
+					}
+					else
+					{
+						expr = new (allocator) AstExprBinary(Location(top.start, expr->location), top.binary, top.left, expr);
+					}
+
+					start = top.start;
+					limit = top.limit;
+				}
 
-			while (op && binaryPriority[op.value()].left > limit)
-			{
 				lexer.next();
 
 				// read sub-expression with higher priority
-				std::pair<AstExpr*, std::optional<AstExprBinary::Op> > next = parseSubExpr(binaryPriority[op.value()].right);
-
-				expr = new (allocator) AstExprBinary(Location(start, next.first->location), op.value(), expr, next.first);
-				op = next.second;
+				pending.push_back({ start, limit, std::nullopt, op.value(), expr });
+				limit = binaryPriority[op.value()].right;
 			}
-
-			return std::make_pair(expr, op);  // return first untreated operator
 		}
 
 		AstExpr* parseExpr()
@@ -1421,7 +1992,25 @@ namespace Luau::Parser
 			}
 			else if (lexer.current().type == Lexeme::Number)
 			{
-				const char* datap = lexer.current().data->c_str();
+				// the lexeme isn't null-terminated; numbers are short, so
+				// terminate a copy on the stack
+				std::string_view number = lexer.current().view();
+
+				char small[64];
+				std::string large;
+				const char* datap = small;
+
+				if (number.size() < sizeof(small))
+				{
+					memcpy(small, number.data(), number.size());
+					small[number.size()] = 0;
+				}
+				else
+				{
+					large.assign(number);
+					datap = large.c_str();
+				}
+
 				char* dataend = NULL;
 
 				double value = strtod(datap, &dataend);
@@ -1441,7 +2030,7 @@ namespace Luau::Parser
 			}
 			else if (lexer.current().type == Lexeme::String)
 			{
-				AstArray<char> value = copy(*lexer.current().data);
+				AstArray<char> value = copy(lexer.current().view());
 
 				lexer.next();
 
@@ -1499,7 +2088,7 @@ namespace Luau::Parser
 			}
 			else if (lexer.current().type == Lexeme::String)
 			{
-				AstExpr* expr = new (allocator) AstExprConstantString(lexer.current().location, copy(*lexer.current().data));
+				AstExpr* expr = new (allocator) AstExprConstantString(lexer.current().location, copy(lexer.current().view()));
 
 				lexer.next();
 
@@ -1609,7 +2198,33 @@ namespace Luau::Parser
 		{
 			AstLocal*& local = localMap[name.name.value];
 
-			local = new (allocator) AstLocal(name.name, name.location, local, functionStack.size());
+			if (incremental && scopeDepth == 0)
+			{
+				// statements reused after the edit refer to the previous parse's
+				// top-level locals; keep using them while the same names are
+				// declared in the same order
+				const auto& previous = incremental->locals;
+
+				if (!localsDiverged && reusedLocals < previous.size()
+					&& previous[reusedLocals]->name == name.name && previous[reusedLocals]->shadow == local)
+				{
+					local = previous[reusedLocals++];
+					movedLocals.emplace_back(local, name.location);
+				}
+				else
+				{
+					localsDiverged = true;
+					local = new (allocator) AstLocal(name.name, name.location, local, functionStack.size());
+				}
+
+				topLevelLocals.push_back(local);
+				localStack.push_back(local);
+
+				return local;
+			}
+
+			Allocator& target = (topLevelAllocator && scopeDepth == 0) ? *topLevelAllocator : allocator;
+			local = new (target) AstLocal(name.name, name.location, local, functionStack.size());
 
 			localStack.push_back(local);
 
@@ -1618,11 +2233,15 @@ namespace Luau::Parser
 
 		unsigned int saveLocals()
 		{
+			scopeDepth++;
+
 			return localStack.size();
 		}
 
 		void restoreLocals(unsigned int offset)
 		{
+			scopeDepth--;
+
 			for (size_t i = localStack.size(); i > offset; --i)
 			{
 				AstLocal* l = localStack[i - 1];
@@ -1679,12 +2298,16 @@ namespace Luau::Parser
 			return copy(data.empty() ? NULL : &data[0], data.size());
 		}
 
-		AstArray<char> copy(const std::string& data)
+		AstArray<char> copy(std::string_view data)
 		{
-			AstArray<char> result = copy(data.c_str(), data.size() + 1);
+			AstArray<char> result;
 
+			result.data = new (allocator) char[data.size() + 1];
 			result.size = data.size();
 
+			memcpy(result.data, data.data(), data.size());
+			result.data[data.size()] = 0;
+
 			return result;
 		}
 
@@ -1734,15 +2357,555 @@ namespace Luau::Parser
 		std::unordered_map<const char*, AstLocal*> localMap;
 		std::vector<AstLocal*> localStack;
 
+		// scopes opened by saveLocals(); 0 is the main chunk when streaming
+		// or reparsing
+		unsigned int scopeDepth = 0;
+		Allocator* topLevelAllocator = nullptr;
+
+		IncrementalParser* incremental = nullptr;
+		// top-level locals declared so far, and how many of them are the
+		// previous parse's
+		std::vector<AstLocal*> topLevelLocals;
+		size_t reusedLocals = 0;
+		bool localsDiverged = false;
+		// reused locals and where they are declared now
+		std::vector<std::pair<AstLocal*, Location>> movedLocals;
+
 		std::vector<AstStat*> scratchStat;
 		std::vector<AstExpr*> scratchExpr;
 		std::vector<AstExpr*> scratchExprAux;
 		std::vector<Name> scratchName;
 		std::vector<AstLocal*> scratchLocal;
+		std::vector<PendingOp> scratchPendingOp;
 	};
 
+	LexemeStream::LexemeStream(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator)
+		: lexer(std::make_unique<Lexer>(buffer, bufferSize, names, allocator))
+	{
+	}
+
+	LexemeStream::~LexemeStream() = default;
+
+	const Lexeme& LexemeStream::current() const
+	{
+		return lexer->current();
+	}
+
+	const Lexeme& LexemeStream::next()
+	{
+		return lexer->next();
+	}
+
+	unsigned int LexemeStream::offset() const
+	{
+		return lexer->currentOffset();
+	}
+
+	unsigned int LexemeStream::endOffset() const
+	{
+		return lexer->endOffset();
+	}
+
 	AstStat* parse(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator)
 	{
 		return Parser::parse(buffer, bufferSize, names, allocator);
 	}
+
+	AstStat* parse(const TokenBuffer& tokens, AstNameTable& names, Allocator& allocator)
+	{
+		return Parser::parse(tokens, names, allocator);
+	}
+
+	size_t parseStreaming(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator, AstVisitor& visitor)
+	{
+		return Parser::parseStreaming(buffer, bufferSize, names, allocator, visitor);
+	}
+
+	AstStat* IncrementalParser::parse(const char* buffer, size_t bufferSize)
+	{
+		statements.clear();
+		locals.clear();
+
+		return reparse(buffer, bufferSize, 0, 0, 0);
+	}
+
+	AstStat* IncrementalParser::reparse(const char* buffer, size_t bufferSize, size_t begin, size_t oldEnd, size_t newEnd)
+	{
+		assert(begin <= oldEnd && begin <= newEnd && newEnd <= bufferSize);
+
+		// the last statement starting before the edit; the edit may extend it
+		size_t first = 0;
+		while (first + 1 < statements.size() && statements[first + 1].offset < begin)
+			first++;
+
+		if (!statements.empty() && statements[first].offset >= begin)
+			first = 0;
+
+		try
+		{
+			return Parser::parseIncremental(*this, buffer, bufferSize, first, oldEnd, newEnd);
+		}
+		catch (...)
+		{
+			// offsets no longer describe the caller's text
+			statements.clear();
+			locals.clear();
+			throw;
+		}
+	}
+
+	static bool inSource(std::string_view contents, const char* buffer, size_t bufferSize)
+	{
+		return uintptr_t(contents.data()) >= uintptr_t(buffer) && uintptr_t(contents.data()) < uintptr_t(buffer + bufferSize);
+	}
+
+	// string contents with escapes live in the lexer's scratch space
+	static std::string_view keepString(std::string_view contents, const char* buffer, size_t bufferSize, Allocator& allocator)
+	{
+		if (inSource(contents, buffer, bufferSize))
+			return contents;
+
+		if (contents.empty())
+			return std::string_view(buffer, 0);
+
+		char* data = new (allocator) char[contents.size()];
+		memcpy(data, contents.data(), contents.size());
+
+		return std::string_view(data, contents.size());
+	}
+
+	void TokenBuffer::push(const Lexeme& lexeme, unsigned int offset, unsigned int end, Allocator& allocator)
+	{
+		unsigned int value = 0;
+
+		if (lexeme.type == Lexeme::Name)
+		{
+			auto [it, inserted] = nameIds.try_emplace(lexeme.name, unsigned(nameTable.size()));
+			if (inserted)
+				nameTable.push_back(AstName(lexeme.name));
+
+			value = it->second;
+		}
+		else if (lexeme.type == Lexeme::String)
+		{
+			value = unsigned(strings.size());
+			strings.push_back(keepString(lexeme.view(), buffer, bufferSize, allocator));
+		}
+
+		types.push_back(uint16_t(lexeme.type));
+		offsets.push_back(offset);
+		ends.push_back(end);
+		lines.push_back(lexeme.location.begin.line);
+		values.push_back(value);
+	}
+
+	Location TokenBuffer::location(size_t index) const
+	{
+		unsigned int line = lines[index];
+		Position begin(line, offsets[index] - lineStarts[line - 1]);
+
+		// long strings and strings with escaped newlines end on a later line
+		unsigned int end = ends[index];
+		if (line < lineStarts.size() && end >= lineStarts[line])
+			line = unsigned(std::upper_bound(lineStarts.begin() + line, lineStarts.end(), end) - lineStarts.begin());
+
+		return Location(begin, Position(line, end - lineStarts[line - 1]));
+	}
+
+	std::string_view TokenBuffer::data(size_t index) const
+	{
+		if (type(index) == Lexeme::String)
+			return strings[values[index]];
+
+		assert(type(index) == Lexeme::Number);
+		return std::string_view(buffer + offsets[index], ends[index] - offsets[index]);
+	}
+
+	Lexeme TokenBuffer::lexeme(size_t index) const
+	{
+		switch (type(index))
+		{
+		case Lexeme::Name:
+			return Lexeme(location(index), Lexeme::Name, nameTable[values[index]].value);
+
+		case Lexeme::String:
+		case Lexeme::Number:
+			return Lexeme(location(index), type(index), data(index));
+
+		default:
+			return Lexeme(location(index), type(index));
+		}
+	}
+
+	// Builds the TokenBuffer for tokenize()
+	class Tokenizer
+	{
+	public:
+		Tokenizer(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator)
+			: buffer(buffer)
+			, bufferSize(bufferSize)
+			, names(names)
+			, allocator(allocator)
+		{
+			result.buffer = buffer;
+			result.bufferSize = bufferSize;
+			result.lineStarts.push_back(0);
+		}
+
+		TokenBuffer run(unsigned int threads)
+		{
+			// below this a piece isn't worth a thread
+			constexpr size_t kMinChunkSize = 1 << 20;
+
+			// pieces start just past a newline, so only their lines are unknown
+			std::vector<std::unique_ptr<Chunk>> chunks;
+
+			size_t count = std::max<size_t>(1, std::min<size_t>(threads, bufferSize / kMinChunkSize));
+			size_t start = 0;
+
+			for (size_t i = 1; i <= count; ++i)
+			{
+				size_t end = bufferSize;
+
+				if (i < count)
+				{
+					size_t target = std::max(start, bufferSize / count * i);
+					const char* newline = static_cast<const char*>(memchr(buffer + target, '\n', bufferSize - target));
+
+					if (!newline)
+						continue;
+
+					end = newline - buffer + 1;
+				}
+
+				auto chunk = std::make_unique<Chunk>();
+				chunk->start = unsigned(start);
+				chunk->end = unsigned(end);
+				chunks.push_back(std::move(chunk));
+
+				start = end;
+
+				if (start == bufferSize)
+					break;
+			}
+
+			try
+			{
+				if (chunks.size() <= 1)
+				{
+					findLineStarts(buffer, 0, unsigned(bufferSize), result.lineStarts);
+
+					// about one lexeme per 4 bytes in typical scripts
+					reserve(bufferSize / 4 + 1);
+
+					relex(~0u, {});
+				}
+				else
+				{
+					runChunks(chunks);
+				}
+			}
+			catch (ParseError& error)
+			{
+				result.lexError = error;
+			}
+
+			return std::move(result);
+		}
+
+	private:
+		// A piece of the buffer lexed on its own thread, as if a lexeme
+		// started at start. It has its own name table and counts lines from 0
+		// at start; runChunks checks the guess and fixes both up.
+		struct Chunk
+		{
+			unsigned int start = 0;
+			unsigned int end = 0;
+
+			Allocator allocator;
+			AstNameTable names{ allocator };
+
+			TokenBuffer tokens;
+
+			// line starts in (start, end]
+			std::vector<unsigned int> lineStarts;
+
+			// the first lexeme at or past end
+			unsigned int stopOffset = 0;
+			Position stopPosition = Position(0, 0);
+			bool eof = false;
+
+			// lexing failed after the last lexeme, which ends at resumeOffset
+			bool failed = false;
+			unsigned int resumeOffset = 0;
+			Position resumePosition = Position(0, 0);
+
+			std::exception_ptr exception;
+		};
+
+		static void findLineStarts(const char* buffer, unsigned int start, unsigned int end, std::vector<unsigned int>& lineStarts)
+		{
+			const char* data = buffer + start;
+			const char* dataEnd = buffer + end;
+
+			while (const char* newline = static_cast<const char*>(memchr(data, '\n', dataEnd - data)))
+			{
+				lineStarts.push_back(unsigned(newline - buffer + 1));
+				data = newline + 1;
+			}
+		}
+
+		static void lexChunk(const char* buffer, size_t bufferSize, Chunk& chunk)
+		{
+			chunk.tokens.buffer = buffer;
+			chunk.tokens.bufferSize = bufferSize;
+
+			chunk.resumeOffset = chunk.start;
+
+			try
+			{
+				findLineStarts(buffer, chunk.start, chunk.end, chunk.lineStarts);
+
+				Lexer lexer(buffer, bufferSize, chunk.names, chunk.allocator, chunk.start, Position(0, 0));
+
+				while (lexer.current().type != Lexeme::Eof && lexer.currentOffset() < chunk.end)
+				{
+					chunk.tokens.push(lexer.current(), lexer.currentOffset(), lexer.endOffset(), chunk.allocator);
+
+					chunk.resumeOffset = lexer.endOffset();
+					chunk.resumePosition = lexer.endPosition();
+
+					lexer.next();
+				}
+
+				chunk.stopOffset = lexer.currentOffset();
+				chunk.stopPosition = lexer.current().location.begin;
+				chunk.eof = lexer.current().type == Lexeme::Eof;
+			}
+			catch (ParseError&)
+			{
+				// only an error if the chunk turns out to start at a lexeme
+				chunk.failed = true;
+			}
+			catch (...)
+			{
+				chunk.exception = std::current_exception();
+			}
+		}
+
+		// moves the chunk's lexemes to absolute lines and shared name ids
+		static void translateChunk(Chunk& chunk, unsigned int firstLine, const std::vector<unsigned int>& ids)
+		{
+			TokenBuffer& tokens = chunk.tokens;
+
+			for (size_t i = 0; i < tokens.size(); ++i)
+			{
+				tokens.lines[i] += firstLine;
+
+				if (tokens.types[i] == Lexeme::Name)
+					tokens.values[i] = ids[tokens.values[i]];
+			}
+
+			chunk.stopPosition.line += firstLine;
+			chunk.resumePosition.line += firstLine;
+		}
+
+		void reserve(size_t size)
+		{
+			result.types.reserve(size);
+			result.offsets.reserve(size);
+			result.ends.reserve(size);
+			result.lines.reserve(size);
+			result.values.reserve(size);
+		}
+
+		bool finished() const
+		{
+			return result.size() > 0 && result.types.back() == Lexeme::Eof;
+		}
+
+		// lexes serially from at up to the first lexeme at or past end, or up
+		// to the first one starting at one of offsets, whose index is returned
+		size_t relex(unsigned int end, const std::vector<unsigned int>& offsets)
+		{
+			Lexer lexer(buffer, bufferSize, names, allocator, at, atPosition);
+
+			size_t next = std::lower_bound(offsets.begin(), offsets.end(), lexer.currentOffset()) - offsets.begin();
+
+			while (lexer.current().type != Lexeme::Eof && lexer.currentOffset() < end)
+			{
+				while (next < offsets.size() && offsets[next] < lexer.currentOffset())
+					next++;
+
+				if (next < offsets.size() && offsets[next] == lexer.currentOffset())
+					return next;
+
+				result.push(lexer.current(), lexer.currentOffset(), lexer.endOffset(), allocator);
+
+				lexer.next();
+			}
+
+			at = lexer.currentOffset();
+			atPosition = lexer.current().location.begin;
+
+			if (lexer.current().type == Lexeme::Eof)
+				result.push(lexer.current(), at, at, allocator);
+
+			return offsets.size();
+		}
+
+		// appends the chunk's lexemes from first on
+		void append(const Chunk& chunk, size_t first)
+		{
+			const TokenBuffer& tokens = chunk.tokens;
+			size_t base = result.size();
+
+			result.types.insert(result.types.end(), tokens.types.begin() + first, tokens.types.end());
+			result.offsets.insert(result.offsets.end(), tokens.offsets.begin() + first, tokens.offsets.end());
+			result.ends.insert(result.ends.end(), tokens.ends.begin() + first, tokens.ends.end());
+			result.lines.insert(result.lines.end(), tokens.lines.begin() + first, tokens.lines.end());
+			result.values.insert(result.values.end(), tokens.values.begin() + first, tokens.values.end());
+
+			for (size_t i = base; i < result.size(); ++i)
+			{
+				if (result.types[i] == Lexeme::String)
+				{
+					std::string_view contents = tokens.strings[result.values[i]];
+
+					result.values[i] = unsigned(result.strings.size());
+					result.strings.push_back(keepString(contents, buffer, bufferSize, allocator));
+				}
+			}
+		}
+
+		void runChunks(std::vector<std::unique_ptr<Chunk>>& chunks)
+		{
+			std::vector<std::thread> workers;
+			for (size_t i = 1; i < chunks.size(); ++i)
+				workers.emplace_back(lexChunk, buffer, bufferSize, std::ref(*chunks[i]));
+
+			lexChunk(buffer, bufferSize, *chunks[0]);
+
+			for (std::thread& worker : workers)
+				worker.join();
+
+			workers.clear();
+
+			for (auto& chunk : chunks)
+				if (chunk->exception)
+					std::rethrow_exception(chunk->exception);
+
+			// only each chunk's distinct names go through the shared table;
+			// the lexemes are then renumbered in parallel
+			std::vector<std::vector<unsigned int>> ids(chunks.size());
+			std::vector<unsigned int> firstLines(chunks.size());
+
+			size_t total = 1;
+			unsigned int line = 1;
+
+			for (size_t i = 0; i < chunks.size(); ++i)
+			{
+				Chunk& chunk = *chunks[i];
+
+				for (AstName name : chunk.tokens.nameTable)
+				{
+					AstName shared = names.getOrAdd(name.value);
+
+					auto [it, inserted] = result.nameIds.try_emplace(shared.value, unsigned(result.nameTable.size()));
+					if (inserted)
+						result.nameTable.push_back(shared);
+
+					ids[i].push_back(it->second);
+				}
+
+				firstLines[i] = line;
+				line += unsigned(chunk.lineStarts.size());
+
+				result.lineStarts.insert(result.lineStarts.end(), chunk.lineStarts.begin(), chunk.lineStarts.end());
+
+				total += chunk.tokens.size();
+			}
+
+			for (size_t i = 1; i < chunks.size(); ++i)
+				workers.emplace_back(translateChunk, std::ref(*chunks[i]), firstLines[i], std::cref(ids[i]));
+
+			translateChunk(*chunks[0], firstLines[0], ids[0]);
+
+			for (std::thread& worker : workers)
+				worker.join();
+
+			reserve(total);
+
+			for (auto& chunkPtr : chunks)
+			{
+				Chunk& chunk = *chunkPtr;
+				const std::vector<unsigned int>& offsets = chunk.tokens.offsets;
+
+				// the chunk's lexemes are right from the first one starting where
+				// the lexemes before it stopped; until then it is lexed again
+				size_t first = std::lower_bound(offsets.begin(), offsets.end(), at) - offsets.begin();
+				bool aligned = first < offsets.size() ? offsets[first] == at : !chunk.failed && chunk.stopOffset == at;
+
+				if (!aligned)
+				{
+					first = relex(chunk.end, offsets);
+
+					if (finished())
+						return;
+
+					if (first == offsets.size())
+						continue;
+				}
+
+				append(chunk, first);
+
+				if (chunk.failed)
+				{
+					// lexing the same bytes again fails the same way
+					at = chunk.resumeOffset;
+					atPosition = chunk.resumePosition;
+
+					relex(chunk.end, {});
+
+					if (finished())
+						return;
+
+					continue;
+				}
+
+				at = chunk.stopOffset;
+				atPosition = chunk.stopPosition;
+
+				if (chunk.eof)
+				{
+					result.push(Lexeme(Location(atPosition, 0), Lexeme::Eof), at, at, allocator);
+					return;
+				}
+			}
+
+			assert(!"tokenize: the last chunk ends at Eof");
+		}
+
+		const char* buffer;
+		size_t bufferSize;
+
+		AstNameTable& names;
+		Allocator& allocator;
+
+		TokenBuffer result;
+
+		// where the next lexeme starts
+		unsigned int at = 0;
+		Position atPosition = Position(1, 0);
+	};
+
+	TokenBuffer tokenize(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator, unsigned int threads)
+	{
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+
+		Tokenizer tokenizer(buffer, bufferSize, names, allocator);
+
+		return tokenizer.run(threads);
+	}
 }
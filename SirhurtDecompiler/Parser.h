@@ -1,12 +1,18 @@
 #pragma once
 #include "TextFormat.h"
 
+#include <array>
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <cassert>
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
 
 #include "parallel_hashmap/phmap.h"
 
@@ -61,6 +67,32 @@ namespace Luau::Parser
 			return page->data;
 		}
 
+		// position to rewind to; everything allocated after it is released
+		struct Checkpoint
+		{
+			void* page;
+			unsigned int offset;
+		};
+
+		Checkpoint checkpoint() const
+		{
+			return { root, offset };
+		}
+
+		void rewind(const Checkpoint& checkpoint)
+		{
+			while (root != checkpoint.page)
+			{
+				Page* next = root->next;
+
+				operator delete(root);
+
+				root = next;
+			}
+
+			offset = checkpoint.offset;
+		}
+
 	private:
 		struct Page
 		{
@@ -1120,10 +1152,15 @@ namespace Luau::Parser
 
 		union
 		{
-			const std::string* data; // String, Number
+			const char* data; // String, Number
 			const char* name; // Name
 		};
 
+		// String, Number: data is not null-terminated. it points into the
+		// source buffer, or at the lexer's scratch space for strings with
+		// escapes, and is only valid until the next lexeme
+		unsigned int length = 0;
+
 		Lexeme(const Location& location, Type type)
 			: type(type)
 			, location(location)
@@ -1136,14 +1173,21 @@ namespace Luau::Parser
 		{
 		}
 
-		Lexeme(const Location& location, Type type, const std::string* data)
+		Lexeme(const Location& location, Type type, std::string_view data)
 			: type(type)
 			, location(location)
-			, data(data)
+			, data(data.data())
+			, length(static_cast<unsigned int>(data.size()))
 		{
 			assert(type == String || type == Number);
 		}
 
+		std::string_view view() const
+		{
+			assert(type == String || type == Number);
+			return std::string_view(data, length);
+		}
+
 		Lexeme(const Location& location, Type type, const char* name)
 			: type(type)
 			, location(location)
@@ -1178,10 +1222,10 @@ namespace Luau::Parser
 				return "'...'";
 
 			case String:
-				return TextFormat::format("\"%s\"", data->c_str());
+				return TextFormat::format("\"%.*s\"", int(length), data);
 
 			case Number:
-				return TextFormat::format("'%s'", data->c_str());
+				return TextFormat::format("'%.*s'", int(length), data);
 
 			case Name:
 				return TextFormat::format("'%s'", name);
@@ -1196,6 +1240,94 @@ namespace Luau::Parser
 		}
 	};
 
+	// Interns names for any number of threads at once, so AstNames from
+	// files parsed on different threads still compare by pointer. Each
+	// submap of the table has its own lock and its own allocator for the
+	// name copies; lookups of names that are already present only take the
+	// lock shared. Parses normally reach it through an AstNameTable, which
+	// caches what it has seen and only asks here for names new to it.
+	class SharedNameTable
+	{
+		static constexpr size_t kSubmapBits = 4;
+
+		using Map = phmap::parallel_flat_hash_map<std::string_view, const char*,
+			phmap::container_internal::hash_default_hash<std::string_view>,
+			phmap::container_internal::hash_default_eq<std::string_view>,
+			phmap::container_internal::Allocator<phmap::container_internal::Pair<const std::string_view, const char*>>,
+			kSubmapBits>;
+
+		// guards the submap with the same index and owns its names. the map's
+		// own locks are not used since they are released before an entry is read
+		struct Shard
+		{
+			std::shared_mutex mutex;
+			Allocator allocator;
+		};
+
+		Map data;
+		std::array<Shard, size_t(1) << kSubmapBits> shards;
+
+		std::atomic<size_t> count{ 0 };
+	public:
+		SharedNameTable()
+		{
+			assert(Map::subcnt() == shards.size());
+		}
+
+		SharedNameTable(const SharedNameTable&) = delete;
+		SharedNameTable& operator=(const SharedNameTable&) = delete;
+
+		// the returned name lives as long as the table
+		AstName getOrAdd(std::string_view name)
+		{
+			size_t hashval = data.hash(name);
+			Shard& shard = shards[Map::subidx(hashval)];
+
+			{
+				std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+				auto it = data.find(name, hashval);
+				if (it != data.end())
+					return AstName(it->second);
+			}
+
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+			// another thread may have added it between the two locks
+			auto it = data.find(name, hashval);
+			if (it != data.end())
+				return AstName(it->second);
+
+			char* nameData = new (shard.allocator) char[name.size() + 1];
+			memcpy(nameData, name.data(), name.size());
+			nameData[name.size()] = 0;
+
+			data.try_emplace(std::string_view(nameData, name.size()), nameData);
+			count.fetch_add(1, std::memory_order_relaxed);
+
+			return AstName(nameData);
+		}
+
+		AstName getOrAdd(const char* name)
+		{
+			return getOrAdd(std::string_view(name));
+		}
+
+		size_t size() const
+		{
+			return count.load(std::memory_order_relaxed);
+		}
+	};
+
+	// Interns identifiers. Names are copied into the table's allocator, so a
+	// table (and its allocator) can outlive the parses that filled it and be
+	// reused for any number of later ones; AstNames from different parses
+	// that share a table compare equal. Reserved words are recognized with a
+	// perfect hash and never stored.
+	//
+	// A table built over a SharedNameTable copies nothing itself: it keeps
+	// the shared table's names, so its AstNames compare equal to those of
+	// every other table over the same one. It is still only for one thread.
 	class AstNameTable
 	{
 		struct Entry
@@ -1204,14 +1336,59 @@ namespace Luau::Parser
 			Lexeme::Type type;
 		};
 
-		phmap::flat_hash_map<std::string, Entry> data;
-		// std::map<const char*, Entr> data;
+		// keys point at the interned copies
+		phmap::flat_hash_map<std::string_view, Entry> data;
 
-		Allocator& allocator;
+		Allocator* allocator = nullptr;
+		SharedNameTable* shared = nullptr;
+
+		static unsigned reservedSlot(std::string_view name)
+		{
+			// (first + last + 8 * length) is distinct for every reserved word
+			return (static_cast<unsigned char>(name.front()) + static_cast<unsigned char>(name.back())
+				+ unsigned(name.size()) * 8) & 63;
+		}
 	public:
 		AstNameTable(Allocator& allocator)
-			: allocator(allocator)
+			: allocator(&allocator)
+		{
+			addStatic("self");
+		}
+
+		AstNameTable(SharedNameTable& shared)
+			: shared(&shared)
 		{
+			addStatic(shared.getOrAdd("self").value);
+		}
+
+		AstNameTable(const AstNameTable&) = delete;
+		AstNameTable& operator=(const AstNameTable&) = delete;
+
+		// Lexeme::Name unless name is a reserved word
+		static Lexeme::Type reservedType(std::string_view name)
+		{
+			constexpr size_t kReservedCount = sizeof(kReserved) / sizeof(kReserved[0]);
+
+			static const auto slots = []
+			{
+				std::array<uint8_t, 64> result{};
+				for (size_t i = 0; i < kReservedCount; ++i)
+				{
+					unsigned slot = reservedSlot(kReserved[i]);
+					assert(result[slot] == 0);
+					result[slot] = uint8_t(i + 1);
+				}
+				return result;
+			}();
+
+			if (name.size() < 2 || name.size() > 8)
+				return Lexeme::Name;
+
+			unsigned index = slots[reservedSlot(name)];
+			if (index == 0 || name != kReserved[index - 1])
+				return Lexeme::Name;
+
+			return static_cast<Lexeme::Type>(Lexeme::Reserved_BEGIN + index - 1);
 		}
 
 		AstName addStatic(const char* name, Lexeme::Type type = Lexeme::Name)
@@ -1224,31 +1401,239 @@ namespace Luau::Parser
 			return entry.value;
 		}
 
-		std::pair<AstName, Lexeme::Type> getOrAddWithType(const char* name)
+		std::pair<AstName, Lexeme::Type> getOrAddWithType(std::string_view name)
 		{
-			auto it = data.find(name);
-			if (it != data.end())
-			{
-				const Entry entry = it->second;
-				return std::make_pair(entry.value, entry.type);
-			}
+			Lexeme::Type type = reservedType(name);
+			if (type != Lexeme::Name)
+				return std::make_pair(AstName(kReserved[type - Lexeme::Reserved_BEGIN]), type);
 
-			size_t nameLength = strlen(name);
+			// hashes and probes once whether or not the name is new
+			auto it = data.lazy_emplace(name, [&](const auto& construct)
+			{
+				const char* nameData;
+				if (shared)
+				{
+					nameData = shared->getOrAdd(name).value;
+				}
+				else
+				{
+					char* copy = new (*allocator) char[name.size() + 1];
+					memcpy(copy, name.data(), name.size());
+					copy[name.size()] = 0;
+					nameData = copy;
+				}
 
-			char* nameData = new (allocator) char[nameLength + 1];
-			memcpy(nameData, name, nameLength + 1);
+				construct(std::string_view(nameData, name.size()), Entry{ AstName(nameData), Lexeme::Name });
+			});
 
-			Entry newEntry = { AstName(nameData), Lexeme::Name };
-			data[nameData] = newEntry;
+			return std::make_pair(it->second.value, it->second.type);
+		}
 
-			return std::make_pair(newEntry.value, newEntry.type);
+		std::pair<AstName, Lexeme::Type> getOrAddWithType(const char* name)
+		{
+			return getOrAddWithType(std::string_view(name));
 		}
 
 		AstName getOrAdd(const char* name)
 		{
 			return getOrAddWithType(name).first;
 		}
+
+		size_t size() const
+		{
+			return data.size();
+		}
+	};
+
+	// The lexemes of a whole buffer, lexed once by tokenize() and kept in
+	// parallel arrays so that each pass over them only touches the fields it
+	// reads. Columns are recovered from the line starts. Names are numbered
+	// within the buffer, so passes can keep per-name data in plain arrays.
+	// Parsing from a TokenBuffer gives the same tree and the same errors as
+	// parsing its source, which must outlive it.
+	class TokenBuffer
+	{
+	public:
+		size_t size() const
+		{
+			return types.size();
+		}
+
+		Lexeme::Type type(size_t index) const
+		{
+			return static_cast<Lexeme::Type>(types[index]);
+		}
+
+		// where the lexeme starts and ends in the source
+		unsigned int offset(size_t index) const
+		{
+			return offsets[index];
+		}
+
+		unsigned int endOffset(size_t index) const
+		{
+			return ends[index];
+		}
+
+		unsigned int line(size_t index) const
+		{
+			return lines[index];
+		}
+
+		Location location(size_t index) const;
+
+		// Name: index into names()
+		unsigned int nameId(size_t index) const
+		{
+			assert(type(index) == Lexeme::Name);
+			return values[index];
+		}
+
+		const std::vector<AstName>& names() const
+		{
+			return nameTable;
+		}
+
+		// String, Number: contents, which stay valid with the buffer
+		std::string_view data(size_t index) const;
+
+		Lexeme lexeme(size_t index) const;
+
+		const char* source() const
+		{
+			return buffer;
+		}
+
+		size_t sourceSize() const
+		{
+			return bufferSize;
+		}
+
+		// set when the lexeme after the last one failed to lex; the buffer
+		// then has no Eof and parsing throws this when it gets there
+		const std::optional<ParseError>& error() const
+		{
+			return lexError;
+		}
+
+	private:
+		friend class Tokenizer;
+
+		void push(const Lexeme& lexeme, unsigned int offset, unsigned int end, Allocator& allocator);
+
+		const char* buffer = nullptr;
+		size_t bufferSize = 0;
+
+		std::vector<uint16_t> types;
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> ends;
+		std::vector<unsigned int> lines;
+		// Name: name id, String: index into strings
+		std::vector<unsigned int> values;
+
+		std::vector<AstName> nameTable;
+		phmap::flat_hash_map<const char*, unsigned int> nameIds;
+
+		std::vector<std::string_view> strings;
+
+		// offset of the start of each line
+		std::vector<unsigned int> lineStarts;
+
+		std::optional<ParseError> lexError;
+	};
+
+	class Lexer;
+
+	// Lexes a buffer one lexeme at a time, for tools that want its lexemes
+	// but no tree. Whitespace and comments are skipped as for the parser and
+	// lexing errors throw ParseError. String and Number contents are only
+	// valid until the next lexeme
+	class LexemeStream
+	{
+	public:
+		LexemeStream(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator);
+		~LexemeStream();
+
+		const Lexeme& current() const;
+		const Lexeme& next();
+
+		// where the current lexeme starts and ends in the buffer
+		unsigned int offset() const;
+		unsigned int endOffset() const;
+
+	private:
+		std::unique_ptr<Lexer> lexer;
 	};
 
 	AstStat* parse(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator);
+
+	// names must be the table tokens was lexed with
+	AstStat* parse(const TokenBuffer& tokens, AstNameTable& names, Allocator& allocator);
+
+	// Parses a chunk and keeps enough about its top-level statements to parse
+	// it again after an edit without starting over. reparse() parses again
+	// from the statement before the edit up to the first statement boundary
+	// after it that lines up with one of the previous parse, and reuses the
+	// previous tree from there on with its lines shifted. Trees returned by
+	// successive calls share nodes, and everything is allocated from
+	// allocator, which grows with every reparse.
+	class IncrementalParser
+	{
+	public:
+		IncrementalParser(AstNameTable& names, Allocator& allocator)
+			: names(names)
+			, allocator(allocator)
+		{
+		}
+
+		AstStat* parse(const char* buffer, size_t bufferSize);
+
+		// buffer is the source of the last successful call with bytes
+		// [begin, oldEnd) replaced by the bytes now at [begin, newEnd). after
+		// a parse error the next call parses everything
+		AstStat* reparse(const char* buffer, size_t bufferSize, size_t begin, size_t oldEnd, size_t newEnd);
+
+		// top-level statements parsed by the last call; the rest were reused
+		size_t reparsedStatements() const
+		{
+			return reparsed;
+		}
+
+	private:
+		friend class Parser;
+
+		struct Statement
+		{
+			AstStat* stat;
+			// where its first token starts
+			unsigned int offset;
+			Position position;
+			// top-level locals declared by it and the statements before it
+			size_t locals;
+		};
+
+		AstNameTable& names;
+		Allocator& allocator;
+
+		std::vector<Statement> statements;
+		// top-level locals in declaration order
+		std::vector<AstLocal*> locals;
+		size_t reparsed = 0;
+	};
+
+	// Parses the main chunk one top-level statement at a time, visiting each
+	// as soon as it is complete and then rewinding allocator to where it was
+	// before the statement, so memory is bounded by the largest statement.
+	// a statement's AST is only valid while it is being visited. names must
+	// use a different allocator. returns the number of statements
+	size_t parseStreaming(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator, AstVisitor& visitor);
+
+	// Lexes the whole buffer into a TokenBuffer. Large buffers are split at
+	// newlines and the pieces lexed on up to threads threads (0 for one per
+	// core), each guessing that it starts at a lexeme; pieces that guessed
+	// wrong, like ones starting in a long string or comment, are lexed again
+	// from where the one before stopped until they line up. Names are
+	// interned in names and string contents with escapes are copied into
+	// allocator. Lexing errors are kept in the buffer rather than thrown
+	TokenBuffer tokenize(const char* buffer, size_t bufferSize, AstNameTable& names, Allocator& allocator, unsigned int threads = 0);
 }
@@ -0,0 +1,152 @@
+#include "ParserBench.h"
+#include "Parser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace Luau::Parser
+{
+	namespace
+	{
+		struct BenchCase
+		{
+			BenchCase(const char* name, std::string source)
+				: name(name), source(std::move(source)) {}
+
+			const char* name;
+			std::string source;
+
+			bool ok = false;
+			double milliseconds = 0;
+			std::string error;
+		};
+
+		std::string chain(size_t operands, const char* op)
+		{
+			std::string source = "local x = a";
+			source.reserve(source.size() + operands * (std::char_traits<char>::length(op) + 3));
+
+			for (size_t i = 1; i < operands; ++i)
+			{
+				source += ' ';
+				source += op;
+				source += " a";
+			}
+
+			source += '\n';
+			return source;
+		}
+
+		std::string unaryRun(size_t operands)
+		{
+			// alternate so no two tokens merge into a comment or a keyword
+			static const char* const ops[] = { "-", "not ", "#" };
+
+			std::string source = "local x = ";
+			for (size_t i = 0; i < operands; ++i)
+				source += ops[i % 3];
+
+			source += "a\n";
+			return source;
+		}
+
+		void runCase(BenchCase& bench)
+		{
+			try
+			{
+				Allocator allocator;
+				Allocator nameAllocator;
+				AstNameTable names(nameAllocator);
+
+				auto start = std::chrono::steady_clock::now();
+				parse(bench.source.data(), bench.source.size(), names, allocator);
+				auto end = std::chrono::steady_clock::now();
+
+				bench.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+				bench.ok = true;
+			}
+			catch (const std::exception& e)
+			{
+				bench.error = e.what();
+			}
+		}
+
+#ifdef _WIN32
+		DWORD WINAPI benchThread(LPVOID data)
+		{
+			runCase(*static_cast<BenchCase*>(data));
+			return 0;
+		}
+
+		bool runOnSmallStack(BenchCase& bench, size_t stackSize)
+		{
+			HANDLE thread = CreateThread(nullptr, stackSize, benchThread, &bench,
+				STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+			if (!thread)
+				return false;
+
+			WaitForSingleObject(thread, INFINITE);
+			CloseHandle(thread);
+			return true;
+		}
+#else
+		void* benchThread(void* data)
+		{
+			runCase(*static_cast<BenchCase*>(data));
+			return nullptr;
+		}
+
+		bool runOnSmallStack(BenchCase& bench, size_t stackSize)
+		{
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setstacksize(&attr, stackSize);
+
+			pthread_t thread;
+			bool started = pthread_create(&thread, &attr, benchThread, &bench) == 0;
+			pthread_attr_destroy(&attr);
+			if (!started)
+				return false;
+
+			pthread_join(thread, nullptr);
+			return true;
+		}
+#endif
+	}
+
+	bool runParserBench(size_t operands, size_t stackSize)
+	{
+		BenchCase cases[] = {
+			{ "concat", chain(operands, "..") },
+			{ "add", chain(operands, "+") },
+			{ "pow", chain(operands, "^") },
+			{ "unary", unaryRun(operands) },
+		};
+
+		bool passed = true;
+
+		for (auto& bench : cases)
+		{
+			if (!runOnSmallStack(bench, stackSize))
+				bench.error = "could not start thread";
+
+			if (bench.ok)
+				printf("%-8s %zu operands: %.2f ms\n", bench.name, operands, bench.milliseconds);
+			else
+				printf("%-8s %zu operands: FAILED %s\n", bench.name, operands, bench.error.c_str());
+
+			passed &= bench.ok;
+		}
+
+		return passed;
+	}
+}
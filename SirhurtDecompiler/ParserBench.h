@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+
+namespace Luau::Parser
+{
+	// Times parsing of long '..', '+' and '^' chains and runs of unary
+	// operators, each on a thread with a small stack so a return to
+	// recursion per operand shows up as a crash rather than a slowdown.
+	// prints one line per case and returns false if any of them failed
+	bool runParserBench(size_t operands = 200000, size_t stackSize = 256 * 1024);
+}
@@ -1,15 +1,17 @@
 // SirhurtDecompiler.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <cstring>
 #include <iostream>
-#include <sstream>
 #include "Decompiler.h"
+#include "ParserBench.h"
+
+int main(int argc, char** argv) {
+	if (argc > 1 && strcmp(argv[1], "--bench-parser") == 0)
+		return Luau::Parser::runParserBench() ? 0 : 1;
 
-int main() {
 	std::cout << "SirHurt LuaU Decompiler\n";
-	std::ostringstream s;
-	Luau::decompile(
-		s, 
+	std::string s = Luau::decompile(
 		{ 
 			0x01, 0x02, 0x05, 0x70, 0x72, 0x69, 0x6e, 0x74, 0x02, 0x68, 0x69, 0x01,
 			0x02, 0x00, 0x00, 0x01, 0x06, 0x41, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x01,
@@ -20,5 +22,5 @@ int main() {
 		}
 	);
 	std::cout << "\n";
-	std::cout << s.str();
+	std::cout.write(s.data(), s.size());
 }
\ No newline at end of file
@@ -65,20 +65,26 @@ namespace Luau::TextFormat {
 			return result;
 		}
 #else 
+		// the first vsnprintf consumes argPtr
+		va_list argCopy;
+		va_copy(argCopy, argPtr);
+
 		char stackBuffer[stackBufferSize];
 		int actualSize = vsnprintf(stackBuffer, stackBufferSize, fmt, argPtr);
 		if (actualSize < stackBufferSize)
+		{
+			va_end(argCopy);
 			return stackBuffer;
+		}
 
 		// Use the heap.
 		if (actualSize > maxSize)
 			actualSize = maxSize;
 
-		char* heapBuffer = new char[actualSize + 1];
-		vsnprintf(heapBuffer, actualSize + 1, fmt, argPtr);
-		heapBuffer[actualSize] = '\0';
+		std::string result(actualSize, '\0');
+		vsnprintf(&result[0], actualSize + 1, fmt, argCopy);
+		va_end(argCopy);
 
-		std::string result(heapBuffer);
 		return result;
 #endif
 